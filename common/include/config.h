@@ -1,10 +1,31 @@
 #pragma once
 
 #include <3ds/types.h>
+#include <3ds/svc.h>
 
 #define CONFIG_DIR "/nextprof"
 #define CONFIG_PATH "/nextprof/config.ini"
 
+#define CONFIG_PROFILE_INSTRUCTION_INTERVAL_MIN 0x1000
+#define CONFIG_PROFILE_INSTRUCTION_INTERVAL_MAX 0x40000000
+#define CONFIG_PROFILE_EVENT_INTERVAL_MIN 0x100
+
+typedef enum {
+    CONFIG_STACK_MODE_RAW,
+    CONFIG_STACK_MODE_FILTERED,
+    CONFIG_STACK_MODE_UNWIND,
+} ConfigStackMode;
+
+typedef enum {
+    CONFIG_RECORD_MODE_STREAM,
+    CONFIG_RECORD_MODE_AGGREGATE,
+} ConfigRecordMode;
+
+typedef enum {
+    CONFIG_RECORD_ON_FULL_BLOCK,
+    CONFIG_RECORD_ON_FULL_DROP,
+} ConfigRecordOnFull;
+
 typedef struct {
     struct {
         char host[60];
@@ -20,11 +41,32 @@ typedef struct {
         bool file;
         bool tcp;
         bool threaded;
+        ConfigRecordMode mode;
+        u32 aggregateInterval;
+        bool schedule;
+        bool syscalls;
+        bool ipc;
+        u32 statsInterval;
+        u32 segments;
+        u32 segmentSize;
+        ConfigRecordOnFull onFull;
+        bool compress;
+        bool chainDictionary;
     } record;
     struct {
         s64 instructionInterval;
+        u32 maxOverheadPercent;
+        PerfCounterEvent event;
+        s64 eventInterval;
+        bool counters;
+        PerfCounterEvent counterEvent;
         u32 stackSize;
+        u32 stackKeyframeInterval;
         u32 maxThreads;
+        bool runningOnly;
+        u32 frameAddress;
+        bool mapStacks;
+        ConfigStackMode stackMode;
     } profile;
 } Config;
 
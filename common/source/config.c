@@ -6,8 +6,6 @@
 #include <sys/stat.h>
 #include <ctype.h>
 
-#define CONFIG_PROFILE_INSTRUCTION_INTERVAL_MIN 0x1000
-
 Config config = {
     .network = {
         .host = "",
@@ -23,11 +21,32 @@ Config config = {
         .file = true,
         .tcp = true,
         .threaded = false,
+        .mode = CONFIG_RECORD_MODE_STREAM,
+        .aggregateInterval = 10000,
+        .schedule = false,
+        .syscalls = false,
+        .ipc = false,
+        .statsInterval = 1000,
+        .segments = 8,
+        .segmentSize = 0x20000,
+        .onFull = CONFIG_RECORD_ON_FULL_BLOCK,
+        .compress = false,
+        .chainDictionary = false,
     },
     .profile = {
         .instructionInterval = 0x100000,
+        .maxOverheadPercent = 0,
+        .event = PERFCOUNTEREVT_CORE_CYCLE_COUNT,
+        .eventInterval = 0x1000,
+        .counters = false,
+        .counterEvent = PERFCOUNTEREVT_CORE_INST_EXECUTED,
         .stackSize = 0,
+        .stackKeyframeInterval = 0,
         .maxThreads = 0,
+        .runningOnly = false,
+        .frameAddress = 0,
+        .mapStacks = true,
+        .stackMode = CONFIG_STACK_MODE_RAW,
     },
 };
 
@@ -79,6 +98,48 @@ Config config = {
         return 1;                                                       \
     }
 
+// Names are indexed by value, values without a name are left out
+#define CHECK_READ_ENUM(field, names)                                   \
+    if (strcasecmp(key, #field) == 0) {                                 \
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)  \
+            if (names[i] && strcasecmp(value, names[i]) == 0)           \
+                cfg->field = i;                                         \
+        return 1;                                                       \
+    }
+
+const char* configProfileEventNames[PERFCOUNTEREVT_CORE_CYCLE_COUNT + 1] = {
+    [PERFCOUNTEREVT_CORE_CYCLE_COUNT] = "Cycles",
+    [PERFCOUNTEREVT_CORE_INST_EXECUTED] = "Instructions",
+    [PERFCOUNTEREVT_CORE_INST_CACHE_MISS] = "InstCacheMiss",
+    [PERFCOUNTEREVT_CORE_DATA_CACHE_READ_MISS] = "DataCacheReadMiss",
+    [PERFCOUNTEREVT_CORE_DATA_CACHE_WRITE_MISS] = "DataCacheWriteMiss",
+    [PERFCOUNTEREVT_CORE_INST_MICROTLB_MISS] = "InstMicroTlbMiss",
+    [PERFCOUNTEREVT_CORE_DATA_MICROTLB_MISS] = "DataMicroTlbMiss",
+    [PERFCOUNTEREVT_CORE_MAIN_TLB_MISS] = "MainTlbMiss",
+    [PERFCOUNTEREVT_CORE_BRANCH_INST] = "Branches",
+    [PERFCOUNTEREVT_CORE_BRANCH_NOT_PREDICTED] = "BranchNotPredicted",
+    [PERFCOUNTEREVT_CORE_BRANCH_MISS_PREDICTED] = "BranchMispredicted",
+    [PERFCOUNTEREVT_CORE_STALL_BY_LACK_OF_INST] = "StallInstruction",
+    [PERFCOUNTEREVT_CORE_STALL_BY_DATA_HAZARD] = "StallDataHazard",
+    [PERFCOUNTEREVT_CORE_STALL_BY_LSU_FULL] = "StallLsuFull",
+};
+
+const char* configRecordModeNames[] = {
+    "Stream",
+    "Aggregate",
+};
+
+const char* configRecordOnFullNames[] = {
+    "Block",
+    "Drop",
+};
+
+const char* configStackModeNames[] = {
+    "Raw",
+    "Filtered",
+    "Unwind",
+};
+
 int configReadCallback(const char* section, const char* key, const char* value, void* userData)
 {
     SECTION_START(network)
@@ -97,12 +158,33 @@ int configReadCallback(const char* section, const char* key, const char* value,
         CHECK_READ_BOOL(file)
         CHECK_READ_BOOL(tcp)
         CHECK_READ_BOOL(threaded)
+        CHECK_READ_ENUM(mode, configRecordModeNames)
+        CHECK_READ_U32(aggregateInterval)
+        CHECK_READ_BOOL(schedule)
+        CHECK_READ_BOOL(syscalls)
+        CHECK_READ_BOOL(ipc)
+        CHECK_READ_U32(statsInterval)
+        CHECK_READ_U32(segments)
+        CHECK_READ_U32(segmentSize)
+        CHECK_READ_ENUM(onFull, configRecordOnFullNames)
+        CHECK_READ_BOOL(compress)
+        CHECK_READ_BOOL(chainDictionary)
     SECTION_END
 
     SECTION_START(profile)
         CHECK_READ_S64(instructionInterval)
+        CHECK_READ_U32(maxOverheadPercent)
+        CHECK_READ_ENUM(event, configProfileEventNames)
+        CHECK_READ_S64(eventInterval)
+        CHECK_READ_BOOL(counters)
+        CHECK_READ_ENUM(counterEvent, configProfileEventNames)
         CHECK_READ_U32(stackSize)
+        CHECK_READ_U32(stackKeyframeInterval)
         CHECK_READ_U32(maxThreads)
+        CHECK_READ_BOOL(runningOnly)
+        CHECK_READ_U32(frameAddress)
+        CHECK_READ_BOOL(mapStacks)
+        CHECK_READ_ENUM(stackMode, configStackModeNames)
     SECTION_END
 
     return 1;
@@ -116,6 +198,18 @@ bool configRead()
     
     if (config.profile.instructionInterval < CONFIG_PROFILE_INSTRUCTION_INTERVAL_MIN)
         config.profile.instructionInterval = CONFIG_PROFILE_INSTRUCTION_INTERVAL_MIN;
+    if (config.profile.instructionInterval > CONFIG_PROFILE_INSTRUCTION_INTERVAL_MAX)
+        config.profile.instructionInterval = CONFIG_PROFILE_INSTRUCTION_INTERVAL_MAX;
+    if (config.profile.eventInterval < CONFIG_PROFILE_EVENT_INTERVAL_MIN)
+        config.profile.eventInterval = CONFIG_PROFILE_EVENT_INTERVAL_MIN;
+    if (config.profile.eventInterval > CONFIG_PROFILE_INSTRUCTION_INTERVAL_MAX)
+        config.profile.eventInterval = CONFIG_PROFILE_INSTRUCTION_INTERVAL_MAX;
+    if (config.profile.maxOverheadPercent > 99)
+        config.profile.maxOverheadPercent = 99;
+
+    // Raw stacks can not be aggregated
+    if (config.record.mode == CONFIG_RECORD_MODE_AGGREGATE && config.profile.stackMode == CONFIG_STACK_MODE_RAW)
+        config.profile.stackMode = CONFIG_STACK_MODE_FILTERED;
 
     return config.network.host[0] != '\0';
 }
@@ -0,0 +1,173 @@
+#include "aggregate.h"
+#include "record.h"
+#include "config.h"
+#include "log.h"
+
+#include <string.h>
+
+// Arena layout: open addressing entry table followed by a pool holding the chains
+#define AGGREGATE_ENTRY_COUNT 0x2000
+
+typedef struct
+{
+    u32 hash;
+    u32 threadId;
+    u32 pc;
+    u32 count;
+    u32 chainOffset;
+    u32 chainCount;
+} AggregateEntry;
+
+static AggregateEntry* aggregateEntries = NULL;
+static u32 aggregateEntriesUsed = 0;
+
+static u32* aggregatePool = NULL;
+static u32 aggregatePoolSize = 0;
+static u32 aggregatePoolUsed = 0;
+
+static u64 aggregateLastFlushTick = 0;
+
+static inline u32 hashWord(u32 hash, u32 word)
+{
+    // FNV-1a over whole words
+    return (hash ^ word) * 0x01000193;
+}
+
+static u32 hashSample(u32 threadId, u32 pc, const u32* chain, u32 chainCount)
+{
+    u32 hash = 0x811C9DC5;
+    hash = hashWord(hash, threadId);
+    hash = hashWord(hash, pc);
+    for (u32 i = 0; i < chainCount; i++)
+        hash = hashWord(hash, chain[i]);
+    // 0 marks a free entry
+    return hash ? hash : 1;
+}
+
+static void aggregateClear()
+{
+    memset(aggregateEntries, 0, sizeof(AggregateEntry) * AGGREGATE_ENTRY_COUNT);
+    aggregateEntriesUsed = 0;
+    aggregatePoolUsed = 0;
+}
+
+void aggregateInit(void* arena, u32 size)
+{
+    aggregateExit();
+
+    if (arena == NULL || size <= sizeof(AggregateEntry) * AGGREGATE_ENTRY_COUNT)
+    {
+        LOG_ERROR("Aggregation arena too small");
+        return;
+    }
+
+    aggregateEntries = arena;
+    aggregatePool = (u32*)(aggregateEntries + AGGREGATE_ENTRY_COUNT);
+    aggregatePoolSize = (size - sizeof(AggregateEntry) * AGGREGATE_ENTRY_COUNT) / sizeof(u32);
+
+    aggregateClear();
+    aggregateLastFlushTick = svcGetSystemTick();
+}
+
+void aggregateExit()
+{
+    aggregateFlush();
+
+    aggregateEntries = NULL;
+    aggregatePool = NULL;
+    aggregatePoolSize = 0;
+}
+
+void aggregateFlush()
+{
+    if (aggregateEntries == NULL)
+        return;
+
+    LOG_TRACE("Flushing %lu aggregated call chains", aggregateEntriesUsed);
+
+    for (u32 i = 0; i < AGGREGATE_ENTRY_COUNT; i++)
+    {
+        const AggregateEntry* entry = &aggregateEntries[i];
+        if (entry->hash == 0)
+            continue;
+
+        if (!recordEnsureSpace(sizeof(u32) * 5 + entry->chainCount * sizeof(u32)))
+        {
+            recordDropSamples(entry->count);
+            continue;
+        }
+
+        recordHeader(RECORD_HEADER_AGGREGATE);
+        recordU32(entry->threadId);
+        recordU32(entry->pc);
+        recordU32(entry->count);
+        recordU32(entry->chainCount);
+        recordData(aggregatePool + entry->chainOffset, entry->chainCount * sizeof(u32));
+    }
+
+    aggregateClear();
+    aggregateLastFlushTick = svcGetSystemTick();
+}
+
+s64 aggregateFlushTimeout()
+{
+    u64 intervalTicks = (u64)config.record.aggregateInterval * (SYSCLOCK_ARM11 / 1000);
+    if (aggregateEntries == NULL || intervalTicks == 0)
+        return -1;
+
+    u64 elapsedTicks = svcGetSystemTick() - aggregateLastFlushTick;
+    if (elapsedTicks >= intervalTicks)
+        return 0;
+    return (s64)((intervalTicks - elapsedTicks) * 1000000000ULL / SYSCLOCK_ARM11);
+}
+
+void aggregateFlushIfDue()
+{
+    if (aggregateFlushTimeout() == 0)
+        aggregateFlush();
+}
+
+void aggregateAdd(u32 threadId, u32 pc, const u32* chain, u32 chainCount)
+{
+    if (aggregateEntries == NULL)
+        return;
+
+    if (chainCount > AGGREGATE_MAX_CHAIN)
+        chainCount = AGGREGATE_MAX_CHAIN;
+
+    aggregateFlushIfDue();
+
+    u32 hash = hashSample(threadId, pc, chain, chainCount);
+    u32 index = hash & (AGGREGATE_ENTRY_COUNT - 1);
+
+    while (aggregateEntries[index].hash != 0)
+    {
+        AggregateEntry* entry = &aggregateEntries[index];
+        if (entry->hash == hash && entry->threadId == threadId && entry->pc == pc && entry->chainCount == chainCount &&
+            memcmp(aggregatePool + entry->chainOffset, chain, chainCount * sizeof(u32)) == 0)
+        {
+            entry->count++;
+            return;
+        }
+        index = (index + 1) & (AGGREGATE_ENTRY_COUNT - 1);
+    }
+
+    // Keep the table at most 3/4 full so probe sequences stay short
+    if (aggregateEntriesUsed + 1 > AGGREGATE_ENTRY_COUNT / 4 * 3 || aggregatePoolUsed + chainCount > aggregatePoolSize)
+    {
+        aggregateFlush();
+        index = hash & (AGGREGATE_ENTRY_COUNT - 1);
+    }
+
+    AggregateEntry* entry = &aggregateEntries[index];
+    entry->hash = hash;
+    entry->threadId = threadId;
+    entry->pc = pc;
+    entry->count = 1;
+    entry->chainOffset = aggregatePoolUsed;
+    entry->chainCount = chainCount;
+
+    memcpy(aggregatePool + aggregatePoolUsed, chain, chainCount * sizeof(u32));
+    aggregatePoolUsed += chainCount;
+    aggregateEntriesUsed++;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <3ds.h>
+
+
+#define AGGREGATE_MAX_CHAIN 0x40
+
+void aggregateInit(void* arena, u32 size);
+void aggregateExit();
+void aggregateAdd(u32 threadId, u32 pc, const u32* chain, u32 chainCount);
+void aggregateFlush();
+
+// Nanoseconds until the periodic flush is due, -1 if there is none. Samples alone cannot trigger it while the debuggee idles.
+s64 aggregateFlushTimeout();
+void aggregateFlushIfDue();
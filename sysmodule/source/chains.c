@@ -0,0 +1,163 @@
+#include "chains.h"
+#include "record.h"
+#include "log.h"
+
+#include <string.h>
+
+// Chain IDs are entry indices, an evicted entry is defined again under the same ID
+#define CHAINS_ENTRY_COUNT  0x100
+#define CHAINS_BUCKET_COUNT 0x100
+#define CHAINS_NONE         0xFFFF
+
+typedef struct
+{
+    u32 hash;
+    u16 chainCount;
+    u16 bucketNext;
+    u16 lruPrev;
+    u16 lruNext;
+} ChainEntry;
+
+static ChainEntry chainEntries[CHAINS_ENTRY_COUNT];
+static u32 chainArena[CHAINS_ENTRY_COUNT][CHAINS_MAX_CHAIN];
+static u16 chainBuckets[CHAINS_BUCKET_COUNT];
+static u16 chainEntriesUsed = 0;
+
+// Most recently used entry first
+static u16 chainLruHead = CHAINS_NONE;
+static u16 chainLruTail = CHAINS_NONE;
+
+static inline u32 hashWord(u32 hash, u32 word)
+{
+    // FNV-1a over whole words
+    return (hash ^ word) * 0x01000193;
+}
+
+static u32 hashChain(const u32* chain, u32 chainCount)
+{
+    u32 hash = 0x811C9DC5;
+    for (u32 i = 0; i < chainCount; i++)
+        hash = hashWord(hash, chain[i]);
+    return hash;
+}
+
+static void lruUnlink(u16 index)
+{
+    ChainEntry* entry = &chainEntries[index];
+
+    if (entry->lruPrev != CHAINS_NONE)
+        chainEntries[entry->lruPrev].lruNext = entry->lruNext;
+    else
+        chainLruHead = entry->lruNext;
+
+    if (entry->lruNext != CHAINS_NONE)
+        chainEntries[entry->lruNext].lruPrev = entry->lruPrev;
+    else
+        chainLruTail = entry->lruPrev;
+}
+
+static void lruPushFront(u16 index)
+{
+    ChainEntry* entry = &chainEntries[index];
+
+    entry->lruPrev = CHAINS_NONE;
+    entry->lruNext = chainLruHead;
+    if (chainLruHead != CHAINS_NONE)
+        chainEntries[chainLruHead].lruPrev = index;
+    chainLruHead = index;
+    if (chainLruTail == CHAINS_NONE)
+        chainLruTail = index;
+}
+
+static void bucketUnlink(u16 index)
+{
+    u16* link = &chainBuckets[chainEntries[index].hash & (CHAINS_BUCKET_COUNT - 1)];
+    while (*link != index)
+        link = &chainEntries[*link].bucketNext;
+    *link = chainEntries[index].bucketNext;
+}
+
+static u16 chainsFind(u32 hash, const u32* chain, u32 chainCount)
+{
+    u16 index = chainBuckets[hash & (CHAINS_BUCKET_COUNT - 1)];
+    while (index != CHAINS_NONE)
+    {
+        const ChainEntry* entry = &chainEntries[index];
+        if (entry->hash == hash && entry->chainCount == chainCount &&
+            memcmp(chainArena[index], chain, chainCount * sizeof(u32)) == 0)
+            return index;
+        index = entry->bucketNext;
+    }
+    return CHAINS_NONE;
+}
+
+static void chainsRecordReference(u32 threadId, u32 pc, u16 index)
+{
+    recordHeader(RECORD_HEADER_SAMPLE_REF);
+    recordU32(threadId);
+    recordU32(pc);
+    recordU32(index);
+}
+
+void chainsInit()
+{
+    memset(chainBuckets, 0xFF, sizeof(chainBuckets));
+    chainEntriesUsed = 0;
+    chainLruHead = CHAINS_NONE;
+    chainLruTail = CHAINS_NONE;
+}
+
+void chainsRecordSample(u32 threadId, u32 pc, const u32* chain, u32 chainCount)
+{
+    u32 hash = hashChain(chain, chainCount);
+
+    u16 index = chainsFind(hash, chain, chainCount);
+    if (index != CHAINS_NONE)
+    {
+        lruUnlink(index);
+        lruPushFront(index);
+
+        if (!recordEnsureSpace(sizeof(u32) * 4))
+        {
+            recordDropSamples(1);
+            return;
+        }
+        chainsRecordReference(threadId, pc, index);
+        return;
+    }
+
+    // Only replace an entry once its new definition is sure to be recorded
+    if (!recordEnsureSpace(sizeof(u32) * 3 + chainCount * sizeof(u32) + sizeof(u32) * 4))
+    {
+        recordDropSamples(1);
+        return;
+    }
+
+    if (chainEntriesUsed < CHAINS_ENTRY_COUNT)
+    {
+        index = chainEntriesUsed++;
+    }
+    else
+    {
+        index = chainLruTail;
+        lruUnlink(index);
+        bucketUnlink(index);
+    }
+
+    ChainEntry* entry = &chainEntries[index];
+    entry->hash = hash;
+    entry->chainCount = chainCount;
+    memcpy(chainArena[index], chain, chainCount * sizeof(u32));
+
+    u16* bucket = &chainBuckets[hash & (CHAINS_BUCKET_COUNT - 1)];
+    entry->bucketNext = *bucket;
+    *bucket = index;
+    lruPushFront(index);
+
+    recordHeader(RECORD_HEADER_CHAIN_DEFINE);
+    recordU32(index);
+    recordU32(chainCount);
+    recordData(chain, chainCount * sizeof(u32));
+
+    chainsRecordReference(threadId, pc, index);
+}
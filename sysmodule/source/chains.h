@@ -0,0 +1,12 @@
+#pragma once
+
+#include <3ds.h>
+
+
+// Longer chains are recorded in full with every sample
+#define CHAINS_MAX_CHAIN 0x40
+
+void chainsInit();
+
+// Records a sample referring to its call chain by ID, the chain is defined first if the reader does not know it yet
+void chainsRecordSample(u32 threadId, u32 pc, const u32* chain, u32 chainCount);
@@ -0,0 +1,221 @@
+#include "code.h"
+#include "csvc.h"
+#include "log.h"
+
+#include <string.h>
+
+// Executable ranges are mapped one after another into this window of our own address space
+#define CODE_MAP_BASE   0x0C000000
+#define CODE_MAP_SIZE   0x02000000
+
+#define CODE_QUERY_START    0x00100000
+#define CODE_QUERY_END      0x40000000
+
+// Bytes compared to tell whether a known range still holds the same code, another CRO has another header
+#define CODE_VERIFY_SIZE    0x100
+
+CodeRange codeRanges[CODE_MAX_RANGES];
+size_t codeRangeCount = 0;
+
+static Handle codeDebug = 0;
+static Handle codeProcess = 0;
+static u32 codeMapUsed = 0;
+
+static void codeMapRange(CodeRange* range)
+{
+    Result r;
+    u32 size = range->end - range->start;
+
+    range->mapped = NULL;
+
+    if (codeProcess == 0 || codeMapUsed + size > CODE_MAP_SIZE)
+        return;
+
+    r = svcMapProcessMemoryEx(codeProcess, CODE_MAP_BASE + codeMapUsed, range->start, size);
+    if (R_FAILED(r))
+    {
+        LOG_WARNING("Mapping code range 0x%08X-0x%08X failed: %08X", range->start, range->end, r);
+        return;
+    }
+
+    range->mapped = (const u8*)(CODE_MAP_BASE + codeMapUsed);
+    codeMapUsed += size;
+}
+
+static bool codeRangeIsCurrent(const CodeRange* range, u32 start, u32 end)
+{
+    u8 current[CODE_VERIFY_SIZE];
+    u32 size = end - start < CODE_VERIFY_SIZE ? end - start : CODE_VERIFY_SIZE;
+
+    if (range->start != start || range->end != end)
+        return false;
+
+    // Unmapped ranges are read from the process on every access, they can not go stale
+    if (range->mapped == NULL)
+        return true;
+
+    if (R_FAILED(svcReadProcessMemory(current, codeDebug, start, size)))
+        return false;
+    return memcmp(current, range->mapped, size) == 0;
+}
+
+static void codeRemoveRange(size_t index)
+{
+    CodeRange* range = &codeRanges[index];
+    u32 size = range->end - range->start;
+
+    LOG_INFO("Code range 0x%08X-0x%08X removed", range->start, range->end);
+
+    if (range->mapped)
+    {
+        svcUnmapProcessMemoryEx(codeProcess, (u32)range->mapped, size);
+
+        // Only the last mapping can be given back, the window space of others stays unused
+        if ((u32)range->mapped + size == CODE_MAP_BASE + codeMapUsed)
+            codeMapUsed -= size;
+    }
+
+    memmove(&codeRanges[index], &codeRanges[index + 1], sizeof(codeRanges[0]) * (codeRangeCount - index - 1));
+    codeRangeCount--;
+}
+
+void codeAddRange(u32 start, u32 end)
+{
+    if (codeDebug == 0)
+        return;
+
+    // Regions are seen again when they are remapped with new permissions, those are kept. Overlapping ranges that
+    // no longer match, e.g. of an unloaded CRO with another one mapped in its place, would filter with stale code.
+    for (size_t i = 0; i < codeRangeCount;)
+    {
+        if (start >= codeRanges[i].end || end <= codeRanges[i].start)
+        {
+            i++;
+            continue;
+        }
+
+        if (codeRangeIsCurrent(&codeRanges[i], start, end))
+            return;
+        codeRemoveRange(i);
+    }
+
+    if (codeRangeCount >= CODE_MAX_RANGES)
+    {
+        LOG_WARNING("Maximum code range count reached, ignoring 0x%08X-0x%08X", start, end);
+        return;
+    }
+
+    CodeRange* range = &codeRanges[codeRangeCount++];
+    range->start = start;
+    range->end = end;
+    codeMapRange(range);
+
+    LOG_INFO("Code range 0x%08X-0x%08X%s", range->start, range->end, range->mapped ? " (mapped)" : "");
+}
+
+void codeInit(Handle debug, Handle process)
+{
+    Result r;
+    MemInfo memInfo;
+    PageInfo pageInfo;
+
+    codeExit();
+
+    codeDebug = debug;
+    codeProcess = process;
+
+    u32 addr = CODE_QUERY_START;
+    while (addr < CODE_QUERY_END)
+    {
+        r = svcQueryDebugProcessMemory(&memInfo, &pageInfo, debug, addr);
+        if (R_FAILED(r) || memInfo.size == 0)
+            break;
+
+        if (memInfo.perm & MEMPERM_EXECUTE)
+            codeAddRange(memInfo.base_addr, memInfo.base_addr + memInfo.size);
+
+        addr = memInfo.base_addr + memInfo.size;
+    }
+}
+
+void codeExit()
+{
+    Result r;
+
+    for (size_t i = 0; i < codeRangeCount; i++)
+    {
+        if (codeRanges[i].mapped == NULL)
+            continue;
+
+        r = svcUnmapProcessMemoryEx(codeProcess, (u32)codeRanges[i].mapped, codeRanges[i].end - codeRanges[i].start);
+        if (R_FAILED(r))
+            LOG_WARNING("Unmapping code range 0x%08X-0x%08X failed: %08X", codeRanges[i].start, codeRanges[i].end, r);
+    }
+
+    codeRangeCount = 0;
+    codeMapUsed = 0;
+    codeDebug = 0;
+    codeProcess = 0;
+}
+
+// Reads the 4 bytes preceding addr, from the mapping if available
+static inline bool codeReadPreceding(const CodeRange* range, u32 addr, u32* out)
+{
+    if (addr < range->start + 4)
+        return false;
+
+    if (range->mapped)
+    {
+        memcpy(out, range->mapped + (addr - 4 - range->start), sizeof(u32));
+        return true;
+    }
+
+    return R_SUCCEEDED(svcReadProcessMemory(out, codeDebug, addr - 4, sizeof(u32)));
+}
+
+bool codeIsReturnAddress(u32 addr)
+{
+    const CodeRange* range = codeGetRange(addr);
+    if (range == NULL)
+        return false;
+
+    // Thumb
+    if (addr & 1)
+    {
+        u32 preceding;
+        if (!codeReadPreceding(range, addr & ~1, &preceding))
+            return false;
+
+        u16 hi = preceding & 0xFFFF;
+        u16 lo = preceding >> 16;
+
+        // BLX <register>
+        if ((lo & 0xFF87) == 0x4780)
+            return true;
+
+        // BL/BLX <immediate> instruction pair
+        if ((hi & 0xF800) == 0xF000 && (lo & 0xE800) == 0xE800)
+            return true;
+
+        return false;
+    }
+
+    // ARM
+    u32 instr;
+    if ((addr & 3) || !codeReadPreceding(range, addr, &instr))
+        return false;
+
+    // BL<cond> <immediate>
+    if ((instr & 0x0F000000) == 0x0B000000)
+        return true;
+
+    // BLX <immediate>
+    if ((instr & 0xFE000000) == 0xFA000000)
+        return true;
+
+    // BLX<cond> <register>
+    if ((instr & 0x0FFFFFF0) == 0x012FFF30)
+        return true;
+
+    return false;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <3ds.h>
+
+
+#define CODE_MAX_RANGES 0x10
+
+typedef struct
+{
+    u32 start;
+    u32 end;
+    const u8* mapped;
+} CodeRange;
+
+extern CodeRange codeRanges[CODE_MAX_RANGES];
+extern size_t codeRangeCount;
+
+void codeInit(Handle debug, Handle process);
+void codeExit();
+
+// Adds code mapped after codeInit
+void codeAddRange(u32 start, u32 end);
+
+static inline const CodeRange* codeGetRange(u32 addr)
+{
+    for (size_t i = 0; i < codeRangeCount; i++)
+    {
+        if (addr >= codeRanges[i].start && addr < codeRanges[i].end)
+            return &codeRanges[i];
+    }
+    return NULL;
+}
+
+static inline bool codeIsExecutable(u32 addr)
+{
+    return codeGetRange(addr) != NULL;
+}
+
+bool codeIsReturnAddress(u32 addr);
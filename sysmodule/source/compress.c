@@ -0,0 +1,110 @@
+#include "compress.h"
+
+#include <string.h>
+
+#define COMPRESS_MIN_MATCH      4
+// The LZ4 format requires the last bytes of a block to be literals
+#define COMPRESS_LAST_LITERALS  5
+#define COMPRESS_MATCH_LIMIT    12
+
+static inline u32 compressRead32(const u8* p)
+{
+    u32 value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline u32 compressHash(u32 value)
+{
+    return (value * 2654435761u) >> (32 - COMPRESS_HASH_BITS);
+}
+
+static u8* compressWriteLength(u8* out, u32 length)
+{
+    while (length >= 0xFF)
+    {
+        *out++ = 0xFF;
+        length -= 0xFF;
+    }
+    *out++ = (u8)length;
+    return out;
+}
+
+// Writes literals followed by a match, a match length of 0 ends the block
+static u8* compressWriteSequence(u8* out, const u8* literals, u32 literalCount, u32 matchLength, u32 offset)
+{
+    u8* token = out++;
+
+    *token = (literalCount >= 0xF ? 0xF : literalCount) << 4;
+    if (literalCount >= 0xF)
+        out = compressWriteLength(out, literalCount - 0xF);
+    memcpy(out, literals, literalCount);
+    out += literalCount;
+
+    if (matchLength == 0)
+        return out;
+
+    *out++ = (u8)offset;
+    *out++ = (u8)(offset >> 8);
+
+    matchLength -= COMPRESS_MIN_MATCH;
+    *token |= matchLength >= 0xF ? 0xF : matchLength;
+    if (matchLength >= 0xF)
+        out = compressWriteLength(out, matchLength - 0xF);
+
+    return out;
+}
+
+u32 compressBlock(CompressState* state, const u8* in, u32 size, u8* out)
+{
+    const u8* ip = in;
+    const u8* anchor = in;
+    const u8* end = in + size;
+    u8* op = out;
+
+    memset(state->table, 0, sizeof(state->table));
+
+    if (size > COMPRESS_MATCH_LIMIT)
+    {
+        const u8* matchLimit = end - COMPRESS_LAST_LITERALS;
+        const u8* searchLimit = end - COMPRESS_MATCH_LIMIT;
+        u32 misses = 0;
+
+        while (ip < searchLimit)
+        {
+            u32 value = compressRead32(ip);
+            u32 hash = compressHash(value);
+            const u8* ref = in + state->table[hash];
+            state->table[hash] = ip - in;
+
+            if (ref >= ip || compressRead32(ref) != value)
+            {
+                // Skip ahead faster through data that does not compress
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            while (ip > anchor && ref > in && ip[-1] == ref[-1])
+            {
+                ip--;
+                ref--;
+            }
+
+            const u8* matchEnd = ip + COMPRESS_MIN_MATCH;
+            const u8* refEnd = ref + COMPRESS_MIN_MATCH;
+            while (matchEnd < matchLimit && *matchEnd == *refEnd)
+            {
+                matchEnd++;
+                refEnd++;
+            }
+
+            op = compressWriteSequence(op, anchor, ip - anchor, matchEnd - ip, ip - ref);
+            ip = matchEnd;
+            anchor = ip;
+        }
+    }
+
+    op = compressWriteSequence(op, anchor, end - anchor, 0, 0);
+    return op - out;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <3ds.h>
+
+
+// Compressed data is written in frames of at most this many input bytes
+#define COMPRESS_BLOCK_SIZE 0x10000
+
+#define COMPRESS_HASH_BITS 12
+
+// Worst case output size of an incompressible block
+#define COMPRESS_BOUND(size) ((size) + (size) / 255 + 16)
+
+// Input positions by hash of the 4 bytes there, blocks are small enough for 16 bit positions.
+// Compressing on several threads at once needs one state per thread.
+typedef struct
+{
+    u16 table[1 << COMPRESS_HASH_BITS];
+} CompressState;
+
+// Compresses a block of at most COMPRESS_BLOCK_SIZE bytes in the LZ4 block format, returns the output size
+u32 compressBlock(CompressState* state, const u8* in, u32 size, u8* out);
@@ -0,0 +1,146 @@
+#include "frame.h"
+#include "record.h"
+#include "log.h"
+
+// Breakpoint registers used, BRP4 and BRP5 are the only ones able to match context IDs
+#define FRAME_BRP_ENTRY     0
+#define FRAME_BRP_RETURN    1
+#define FRAME_BRP_CONTEXT   5
+
+// Breakpoint control register fields
+#define BCR_ENABLE              BIT(0)
+#define BCR_ANY_MODE            (3 << 1)
+#define BCR_BYTE_SELECT(bas)    ((bas) << 5)
+#define BCR_LINKED_BRP(brp)     ((brp) << 16)
+#define BCR_LINK_ENABLE         BIT(20)
+#define BCR_MATCH_CONTEXT_ID    (1 << 21)
+
+static Handle frameDebug = 0;
+static u32 frameAddress = 0;
+static u32 frameReturnAddress = 0;
+
+static u32 frameByteSelect(u32 addr)
+{
+    // Thumb instructions are halfwords within the matched word
+    if (addr & 1)
+        return (addr & 2) ? 0xC : 0x3;
+    return 0xF;
+}
+
+static Result frameSetBreakpoint(s32 brp, u32 addr)
+{
+    // Address breakpoints are linked to the context ID breakpoint so only the debuggee hits them
+    u32 control = BCR_ENABLE | BCR_ANY_MODE | BCR_BYTE_SELECT(frameByteSelect(addr))
+                | BCR_LINK_ENABLE | BCR_LINKED_BRP(FRAME_BRP_CONTEXT);
+    return svcSetHardwareBreakPoint(brp, control, addr & ~3);
+}
+
+static void frameClearBreakpoint(s32 brp)
+{
+    svcSetHardwareBreakPoint(brp, 0, 0);
+}
+
+void frameInit(Handle debug, u32 address)
+{
+    Result r;
+
+    frameExit();
+
+    if (address == 0)
+        return;
+
+    // The kernel translates the debug handle into the context ID of the debuggee
+    r = svcSetHardwareBreakPoint(FRAME_BRP_CONTEXT, BCR_ENABLE | BCR_ANY_MODE | BCR_BYTE_SELECT(0xF) | BCR_MATCH_CONTEXT_ID, debug);
+    if (R_FAILED(r))
+    {
+        LOG_WARNING("Setting context ID breakpoint failed, frames will not be marked: %08X", r);
+        return;
+    }
+
+    r = frameSetBreakpoint(FRAME_BRP_ENTRY, address);
+    if (R_FAILED(r))
+    {
+        LOG_WARNING("Setting frame breakpoint at 0x%08X failed: %08X", address, r);
+        frameClearBreakpoint(FRAME_BRP_CONTEXT);
+        return;
+    }
+
+    LOG_INFO("Marking frames at 0x%08X", address);
+
+    frameDebug = debug;
+    frameAddress = address;
+}
+
+void frameExit()
+{
+    if (frameAddress == 0)
+        return;
+
+    frameClearBreakpoint(FRAME_BRP_RETURN);
+    frameClearBreakpoint(FRAME_BRP_ENTRY);
+    frameClearBreakpoint(FRAME_BRP_CONTEXT);
+
+    frameDebug = 0;
+    frameAddress = 0;
+    frameReturnAddress = 0;
+}
+
+static void frameRecord(u32 threadId, u64 tick)
+{
+    if (!recordEnsureSpace(sizeof(u32) * 4))
+        return;
+    recordHeader(RECORD_HEADER_FRAME);
+    recordU32(threadId);
+    recordU32((u32)tick);
+    recordU32((u32)(tick >> 32));
+}
+
+bool frameHandleBreakpoint(u32 threadId, u32 address)
+{
+    Result r;
+    ThreadContext context;
+
+    if (frameAddress == 0)
+        return false;
+
+    // A breakpoint hits before its instruction runs and would hit again on continue.
+    // The entry breakpoint is swapped for one on the return address and back, so every
+    // call is seen once.
+    if (address == (frameAddress & ~1))
+    {
+        frameRecord(threadId, svcGetSystemTick());
+
+        r = svcGetDebugThreadContext(&context, frameDebug, threadId, THREADCONTEXT_CONTROL_CPU_SPRS);
+        if (R_FAILED(r))
+        {
+            LOG_WARNING("Getting frame thread context failed, frames will not be marked: %08X", r);
+            frameExit();
+            return true;
+        }
+
+        frameClearBreakpoint(FRAME_BRP_ENTRY);
+        frameReturnAddress = context.cpu_registers.lr;
+        r = frameSetBreakpoint(FRAME_BRP_RETURN, frameReturnAddress);
+        if (R_FAILED(r))
+        {
+            LOG_WARNING("Setting frame return breakpoint failed, frames will not be marked: %08X", r);
+            frameExit();
+        }
+        return true;
+    }
+
+    if (frameReturnAddress != 0 && address == (frameReturnAddress & ~1))
+    {
+        frameClearBreakpoint(FRAME_BRP_RETURN);
+        frameReturnAddress = 0;
+        r = frameSetBreakpoint(FRAME_BRP_ENTRY, frameAddress);
+        if (R_FAILED(r))
+        {
+            LOG_WARNING("Rearming frame breakpoint failed, frames will not be marked: %08X", r);
+            frameExit();
+        }
+        return true;
+    }
+
+    return false;
+}
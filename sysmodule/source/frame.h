@@ -0,0 +1,10 @@
+#pragma once
+
+#include <3ds.h>
+
+
+void frameInit(Handle debug, u32 address);
+void frameExit();
+
+// Handles a breakpoint stop point, returns false if it was not one of ours
+bool frameHandleBreakpoint(u32 threadId, u32 address);
@@ -9,6 +9,15 @@
 #include "log.h"
 #include "record.h"
 #include "luma.h"
+#include "csvc.h"
+#include "code.h"
+#include "unwind.h"
+#include "aggregate.h"
+#include "frame.h"
+#include "service.h"
+#include "module.h"
+#include "stats.h"
+#include "chains.h"
 
 
 #define TERMINATE_IF_R_FAILED(r, format, ...)   \
@@ -43,34 +52,225 @@ void socShutdown()
     socBuf = NULL;
 }
 
+// Every core has its own performance monitor interrupt, 0x78 for core 0 up to 0x7B for core 3
+#define PMC_MAX_CORES       4
+#define PMC_INTERRUPT_BASE  0x78
+
 union 
 {
     struct
     {
         Handle notification;
-        Handle perfCounterOverflowEvent;
+        Handle perfCounterOverflowEvents[PMC_MAX_CORES];
         Handle debuggeeProcess;
     };
-    Handle wait[3];
+    Handle wait[2 + PMC_MAX_CORES];
 } handles;
 
 s32 waitHandlesActive = 0;
 
+Handle debuggeeProcessHandle = 0;
+u64 debuggeeProgramId = 0;
+char debuggeeProcessName[8];
+
 bool attached = false;
 
 #define MAX_ATTACHED_THREADS 0x20
 
+// Thread stacks are mapped into fixed size slots of our own address space
+#define STACK_MAP_BASE      0x0A000000
+#define STACK_MAP_SLOT_SIZE 0x00100000
+
 typedef struct
 {
     u32 id;
     u32 startAddress;
+    u32 stackBottom;
     u32 stackTop;
+    u32 tls;
+    s32 stackMapSlot;
+    u32 stackMapSrc;
+    u32 stackMapSize;
+    s32 stackSnapshotSlot;
+    u32 stackSnapshotSp;
+    u32 stackSnapshotSize;
+    u32 samplesSinceKeyframe;
+    s32 slot;
+    bool slotRecorded;
+    bool running;
+    bool ranSinceSample;
 } AttachedThread;
 
 AttachedThread attachedThreads[MAX_ATTACHED_THREADS];
 size_t attachedThreadCount = 0;
 
-bool addAttachedThread(u32 threadId, u32 pc, u32 sp)
+u32 stackMapSlotsUsed = 0;
+
+// Stable small index per thread for compact packets, unlike the position in attachedThreads
+u32 threadSlotsUsed = 0;
+
+static inline u8* getStackMapAddress(s32 slot)
+{
+    return (u8*)(STACK_MAP_BASE + slot * STACK_MAP_SLOT_SIZE);
+}
+
+u32 stackBuffer[0x4000];
+
+// Most of a stack read for a sample, unwinding reads as deep as the chain goes
+static inline u32 getMaxStackRead()
+{
+    if (config.profile.stackMode == CONFIG_STACK_MODE_UNWIND)
+        return sizeof(stackBuffer);
+
+    u32 size = config.profile.stackSize & ~3;
+    return size > sizeof(stackBuffer) ? sizeof(stackBuffer) : size;
+}
+
+// Stack bounds from the memory block holding sp. Threads started after the attach are attached with sp at their
+// exact top. Threads that were running before may be deep into their stack, which may also be part of a larger
+// block like the heap. Their top is only guessed as the most that is read above sp, limited to the block.
+void findThreadStack(AttachedThread* thread, u32 sp, bool started)
+{
+    Result r;
+    MemInfo memInfo;
+    PageInfo pageInfo;
+
+    thread->stackBottom = 0;
+    thread->stackTop = sp;
+
+    // The stack top itself may be the end of the stack memory block
+    r = svcQueryDebugProcessMemory(&memInfo, &pageInfo, handles.debuggeeProcess, sp - 1);
+    if (R_FAILED(r))
+    {
+        LOG_WARNING("Querying stack memory failed (thread ID: %lu): %08X", thread->id, r);
+        return;
+    }
+
+    thread->stackBottom = memInfo.base_addr;
+    if (!started)
+    {
+        LOG_INFO(" Stack 0x%08X-0x%08X", thread->stackBottom, thread->stackTop);
+        return;
+    }
+
+    u32 blockEnd = memInfo.base_addr + memInfo.size;
+    thread->stackTop = blockEnd - sp > getMaxStackRead() ? sp + getMaxStackRead() : blockEnd;
+
+    LOG_INFO(" Stack 0x%08X-0x%08X (top guessed, thread started before attach)", thread->stackBottom, thread->stackTop);
+}
+
+void mapThreadStack(AttachedThread* thread)
+{
+    Result r;
+
+    thread->stackMapSlot = -1;
+
+    if (!config.profile.mapStacks || debuggeeProcessHandle == 0)
+        return;
+
+    s32 slot = 0;
+    while (slot < MAX_ATTACHED_THREADS && (stackMapSlotsUsed & BIT(slot)))
+        slot++;
+    if (slot >= MAX_ATTACHED_THREADS)
+        return;
+
+    if (thread->stackBottom == 0)
+        return;
+
+    // Memory blocks are page aligned, so the rounded up top stays within the block
+    u32 mapEnd = (thread->stackTop + 0xFFF) & ~0xFFF;
+    u32 mapStart = thread->stackBottom;
+    if (mapEnd - mapStart > STACK_MAP_SLOT_SIZE)
+        mapStart = mapEnd - STACK_MAP_SLOT_SIZE;
+
+    r = svcMapProcessMemoryEx(debuggeeProcessHandle, (u32)getStackMapAddress(slot), mapStart, mapEnd - mapStart);
+    if (R_FAILED(r))
+    {
+        LOG_WARNING("Mapping stack failed (thread ID: %lu), falling back to reads: %08X", thread->id, r);
+        return;
+    }
+
+    LOG_INFO(" Mapped stack 0x%08X-0x%08X to slot %ld", mapStart, mapEnd, slot);
+
+    stackMapSlotsUsed |= BIT(slot);
+    thread->stackMapSlot = slot;
+    thread->stackMapSrc = mapStart;
+    thread->stackMapSize = mapEnd - mapStart;
+}
+
+void unmapThreadStack(AttachedThread* thread)
+{
+    Result r;
+
+    if (thread->stackMapSlot < 0)
+        return;
+
+    r = svcUnmapProcessMemoryEx(debuggeeProcessHandle, (u32)getStackMapAddress(thread->stackMapSlot), thread->stackMapSize);
+    if (R_FAILED(r))
+        LOG_WARNING("Unmapping stack failed (thread ID: %lu): %08X", thread->id, r);
+
+    stackMapSlotsUsed &= ~BIT(thread->stackMapSlot);
+    thread->stackMapSlot = -1;
+}
+
+// Raw stacks of the previous sample per thread, only the part that changed since is recorded
+#define STACK_SNAPSHOT_POOL_SIZE 0x20000
+
+u32 stackSnapshotPool[STACK_SNAPSHOT_POOL_SIZE / sizeof(u32)];
+u32 stackSnapshotSlotsUsed = 0;
+
+static inline u32 getStackSnapshotSlotSize()
+{
+    u32 size = config.profile.stackSize & ~3;
+    return size > sizeof(stackBuffer) ? sizeof(stackBuffer) : size;
+}
+
+static inline u32* getStackSnapshot(s32 slot)
+{
+    return stackSnapshotPool + slot * (getStackSnapshotSlotSize() / sizeof(u32));
+}
+
+void allocStackSnapshot(AttachedThread* thread)
+{
+    thread->stackSnapshotSlot = -1;
+
+    bool rawStacks = config.profile.stackMode != CONFIG_STACK_MODE_FILTERED && config.record.mode != CONFIG_RECORD_MODE_AGGREGATE;
+    if (!rawStacks || config.profile.stackKeyframeInterval == 0 || getStackSnapshotSlotSize() == 0)
+        return;
+
+    // Threads without a slot always record full stacks
+    s32 slotCount = STACK_SNAPSHOT_POOL_SIZE / getStackSnapshotSlotSize();
+    s32 slot = 0;
+    while (slot < slotCount && slot < MAX_ATTACHED_THREADS && (stackSnapshotSlotsUsed & BIT(slot)))
+        slot++;
+    if (slot >= slotCount || slot >= MAX_ATTACHED_THREADS)
+        return;
+
+    stackSnapshotSlotsUsed |= BIT(slot);
+    thread->stackSnapshotSlot = slot;
+    thread->stackSnapshotSize = 0;
+}
+
+void freeStackSnapshot(AttachedThread* thread)
+{
+    if (thread->stackSnapshotSlot < 0)
+        return;
+
+    stackSnapshotSlotsUsed &= ~BIT(thread->stackSnapshotSlot);
+    thread->stackSnapshotSlot = -1;
+}
+
+// Returns the mapped stack data for [sp, sp + size) or NULL if not mapped
+static inline const void* getMappedStack(const AttachedThread* thread, u32 sp, u32 size)
+{
+    if (thread->stackMapSlot < 0)
+        return NULL;
+    if (sp < thread->stackMapSrc || sp + size > thread->stackMapSrc + thread->stackMapSize)
+        return NULL;
+    return getStackMapAddress(thread->stackMapSlot) + (sp - thread->stackMapSrc);
+}
+
+bool addAttachedThread(u32 threadId, u32 pc, u32 sp, u32 tls)
 {
     if (attachedThreadCount >= MAX_ATTACHED_THREADS)
     {
@@ -78,21 +278,46 @@ bool addAttachedThread(u32 threadId, u32 pc, u32 sp)
         return false;
     }
 
-    attachedThreads[attachedThreadCount++] = (AttachedThread){
+    AttachedThread* thread = &attachedThreads[attachedThreadCount++];
+    *thread = (AttachedThread){
         .id = threadId,
         .startAddress = pc,
-        .stackTop = sp
+        .tls = tls,
+        .stackMapSlot = -1,
+        .stackSnapshotSlot = -1,
     };
 
+    while (threadSlotsUsed & BIT(thread->slot))
+        thread->slot++;
+    threadSlotsUsed |= BIT(thread->slot);
+
+    findThreadStack(thread, sp, !attached);
+    mapThreadStack(thread);
+    allocStackSnapshot(thread);
+
     return true;
 }
 
+void removeAllAttachedThreads()
+{
+    for (size_t i = 0; i < attachedThreadCount; i++)
+    {
+        unmapThreadStack(&attachedThreads[i]);
+        freeStackSnapshot(&attachedThreads[i]);
+    }
+    attachedThreadCount = 0;
+    threadSlotsUsed = 0;
+}
+
 bool removeAttachedThread(u32 threadId)
 {
     for (size_t i = 0; i < attachedThreadCount; i++)
     {
         if (attachedThreads[i].id == threadId)
         {
+            unmapThreadStack(&attachedThreads[i]);
+            freeStackSnapshot(&attachedThreads[i]);
+            threadSlotsUsed &= ~BIT(attachedThreads[i].slot);
             for (size_t j = i; j < attachedThreadCount - 1; j++)
             {
                 attachedThreads[j] = attachedThreads[j + 1];
@@ -156,45 +381,311 @@ void PMC_reset()
     TERMINATE_IF_R_FAILED(r, "PMC reset failed");
 }
 
-void PMC_resetInterrupt()
+u64 PMC_getValue(PerfCounterRegister reg)
+{
+    Result r;
+    u64 out;
+
+    r = svcControlPerformanceCounter(&out, PERFCOUNTEROP_GET_VALUE, reg, 0);
+    TERMINATE_IF_R_FAILED(r, "PMC get value failed (register: %d): %08X", reg, r);
+
+    return out;
+}
+
+s64 sampleInterval = 0;
+bool sampleIntervalDropped = false;
+u64 overflowTick = 0;
+u64 resumeTick = 0;
+
+u32 pmcCoreCount = 2;
+u32 overflowCore = 0;
+bool breakPending = false;
+
+// Counter values of the overflowed core at the last overflow, all counters are reset on resume so these are deltas
+bool overflowCountersRead = false;
+u32 overflowCycles = 0;
+u32 overflowEventCount = 0;
+u32 overflowCounterCount = 0;
+
+// Core counter registers are banked, svcControlPerformanceCounter only reaches those of the calling core.
+// Every core has to be armed, reset and read on itself, other cores than our own by a thread pinned there.
+typedef struct
+{
+    Thread thread;
+    LightEvent requestEvent;
+    LightEvent doneEvent;
+    void (*request)();
+} PmcCoreWorker;
+
+PmcCoreWorker pmcCoreWorkers[PMC_MAX_CORES];
+volatile bool pmcCoreWorkersShouldExit = false;
+
+void PMC_coreWorkerFunc(void* arg)
+{
+    PmcCoreWorker* worker = arg;
+
+    while (true)
+    {
+        LightEvent_Wait(&worker->requestEvent);
+        if (pmcCoreWorkersShouldExit)
+            break;
+
+        worker->request();
+        LightEvent_Signal(&worker->doneEvent);
+    }
+}
+
+// Runs the request on the given core, fails for cores outside of our affinity mask
+bool PMC_runOnCore(u32 core, void (*request)())
+{
+    if (core == (u32)svcGetProcessorID())
+    {
+        request();
+        return true;
+    }
+
+    PmcCoreWorker* worker = &pmcCoreWorkers[core];
+    if (!worker->thread)
+        return false;
+
+    worker->request = request;
+    LightEvent_Signal(&worker->requestEvent);
+    LightEvent_Wait(&worker->doneEvent);
+    return true;
+}
+
+void PMC_resetLocalInterrupt()
 {
     Result r;
     u64 out;
 
     PMC_reset();
-    r = svcControlPerformanceCounter(&out, PERFCOUNTEROP_SET_VALUE, 0, (u64)-config.profile.instructionInterval);
+    r = svcControlPerformanceCounter(&out, PERFCOUNTEROP_SET_VALUE, 0, (u64)-sampleInterval);
     TERMINATE_IF_R_FAILED(r, "PMC reset interrupt failed");
 }
 
-void PMC_setInterrupt()
+void PMC_resetInterrupt()
+{
+    for (u32 core = 0; core < pmcCoreCount; core++)
+        PMC_runOnCore(core, PMC_resetLocalInterrupt);
+}
+
+void recordSampleInterval()
+{
+    // Applies to all following samples, so aggregated counts of the previous interval go first
+    aggregateFlush();
+
+    // Samples are weighted by it, so a dropped one is recorded again with the next break
+    sampleIntervalDropped = !recordEnsureSpace(sizeof(u32) * 2);
+    if (sampleIntervalDropped)
+        return;
+    recordHeader(RECORD_HEADER_INTERVAL);
+    recordU32(sampleInterval);
+}
+
+s64 getConfiguredSampleInterval()
+{
+    if (config.profile.event == PERFCOUNTEREVT_CORE_CYCLE_COUNT)
+        return config.profile.instructionInterval;
+    return config.profile.eventInterval;
+}
+
+s64 getMinSampleInterval()
+{
+    if (config.profile.event == PERFCOUNTEREVT_CORE_CYCLE_COUNT)
+        return CONFIG_PROFILE_INSTRUCTION_INTERVAL_MIN;
+    return CONFIG_PROFILE_EVENT_INTERVAL_MIN;
+}
+
+void initSampleInterval()
+{
+    sampleInterval = getConfiguredSampleInterval();
+    overflowTick = 0;
+    resumeTick = 0;
+
+    if (!recordEnsureSpace(sizeof(u32) * 3))
+        return;
+    recordHeader(RECORD_HEADER_EVENT);
+    recordU32(config.profile.event);
+    recordU32(config.profile.counterEvent);
+
+    recordSampleInterval();
+}
+
+// Retunes the sample interval so the cost of a sample stays at the configured share of the run time
+void adaptSampleInterval(u64 now)
+{
+    u64 cost = now - overflowTick;
+    u64 run = overflowTick - resumeTick;
+    bool valid = resumeTick != 0 && overflowTick > resumeTick;
+
+    resumeTick = now;
+
+    if (config.profile.maxOverheadPercent == 0 || !valid)
+        return;
+
+    u64 targetRun = cost * (100 - config.profile.maxOverheadPercent) / config.profile.maxOverheadPercent;
+    s64 interval = (s64)((u64)sampleInterval * targetRun / run);
+
+    // Only move part of the way, single sample costs are noisy
+    interval = (sampleInterval * 3 + interval) / 4;
+
+    if (interval < getMinSampleInterval())
+        interval = getMinSampleInterval();
+    if (interval > CONFIG_PROFILE_INSTRUCTION_INTERVAL_MAX)
+        interval = CONFIG_PROFILE_INSTRUCTION_INTERVAL_MAX;
+
+    // Ignore changes below 1/8, each change costs a record
+    s64 delta = interval > sampleInterval ? interval - sampleInterval : sampleInterval - interval;
+    if (delta * 8 < sampleInterval)
+        return;
+
+    LOG_TRACE("Sample interval 0x%llX -> 0x%llX", sampleInterval, interval);
+
+    sampleInterval = interval;
+    recordSampleInterval();
+}
+
+void PMC_setLocalInterrupt()
 {
     Result r;
     u64 out;
 
-    r = svcClearEvent(handles.perfCounterOverflowEvent);
-    TERMINATE_IF_R_FAILED(r, "Clearing perf counter overflow event failed");
-
-    r = svcControlPerformanceCounter(&out, PERFCOUNTEROP_SET_EVENT, 0, PERFCOUNTEREVT_CORE_CYCLE_COUNT);
+    r = svcControlPerformanceCounter(&out, PERFCOUNTEROP_SET_EVENT, PERFCOUNTERREG_CORE_COUNT_REG_0, config.profile.event);
     TERMINATE_IF_R_FAILED(r, "PMC set interrupt failed");
+
+    if (config.profile.counters)
+    {
+        r = svcControlPerformanceCounter(&out, PERFCOUNTEROP_SET_EVENT, PERFCOUNTERREG_CORE_COUNT_REG_1, config.profile.counterEvent);
+        TERMINATE_IF_R_FAILED(r, "PMC set counter event failed");
+    }
+}
+
+void PMC_setInterrupt()
+{
+    Result r;
+
+    for (u32 core = 0; core < PMC_MAX_CORES; core++)
+    {
+        r = svcClearEvent(handles.perfCounterOverflowEvents[core]);
+        TERMINATE_IF_R_FAILED(r, "Clearing perf counter overflow event failed");
+    }
+
+    for (u32 core = 0; core < pmcCoreCount; core++)
+        PMC_runOnCore(core, PMC_setLocalInterrupt);
+}
+
+void PMC_readLocalCounters()
+{
+    overflowCycles = PMC_getValue(PERFCOUNTERREG_CORE_CYCLE_COUNTER);
+    // The sampling counter started at -sampleInterval and has counted on past the overflow
+    overflowEventCount = sampleInterval + (u32)PMC_getValue(PERFCOUNTERREG_CORE_COUNT_REG_0);
+    overflowCounterCount = PMC_getValue(PERFCOUNTERREG_CORE_COUNT_REG_1);
+}
+
+// Reads the counters of the given core, fails for cores outside of our affinity mask
+bool PMC_readCounters(u32 core)
+{
+    return PMC_runOnCore(core, PMC_readLocalCounters);
+}
+
+void PMC_initCoreWorkers()
+{
+    pmcCoreWorkersShouldExit = false;
+
+    // Above the main thread, the read has to happen before the debuggee is broken
+    s32 priority = 0x30;
+    svcGetThreadPriority(&priority, CUR_THREAD_HANDLE);
+    priority -= 1;
+    priority = priority < 0x18 ? 0x18 : priority;
+
+    u32 ownCore = svcGetProcessorID();
+    for (u32 core = 0; core < pmcCoreCount; core++)
+    {
+        PmcCoreWorker* worker = &pmcCoreWorkers[core];
+        worker->thread = NULL;
+        if (core == ownCore)
+            continue;
+
+        LightEvent_Init(&worker->requestEvent, RESET_ONESHOT);
+        LightEvent_Init(&worker->doneEvent, RESET_ONESHOT);
+        worker->thread = threadCreate(PMC_coreWorkerFunc, worker, 0x1000, priority, core, false);
+        if (worker->thread == NULL)
+            LOG_WARNING("Core %lu can not be armed, it only breaks once its counter wraps and without counters", core);
+    }
+}
+
+void PMC_exitCoreWorkers()
+{
+    pmcCoreWorkersShouldExit = true;
+    for (u32 core = 0; core < PMC_MAX_CORES; core++)
+    {
+        PmcCoreWorker* worker = &pmcCoreWorkers[core];
+        if (!worker->thread)
+            continue;
+
+        LightEvent_Signal(&worker->requestEvent);
+        threadJoin(worker->thread, U64_MAX);
+        threadFree(worker->thread);
+        worker->thread = NULL;
+    }
+}
+
+bool recordBreak()
+{
+    if (!recordEnsureSpace(sizeof(u32) * 4))
+        return false;
+    recordHeader(RECORD_HEADER_BREAK);
+    recordU32((u32)overflowTick);
+    recordU32((u32)(overflowTick >> 32));
+    recordU32(overflowCore);
+    return true;
+}
+
+// Counters only belong to the thread that was running on the overflowed core, -1 if none of the debuggee's was
+void recordCounters(u32 threadId)
+{
+    if (!recordEnsureSpace(sizeof(u32) * 5))
+        return;
+    recordHeader(RECORD_HEADER_COUNTERS);
+    recordU32(overflowCycles);
+    recordU32(overflowEventCount);
+    recordU32(overflowCounterCount);
+    recordU32(threadId);
 }
 
 void PMC_init()
 {
     Result r;
 
-    r = svcCreateEvent(&handles.perfCounterOverflowEvent, RESET_ONESHOT);
-    TERMINATE_IF_R_FAILED(r, "Creating perf counter overflow event failed: %08X", r);
-    r = svcClearEvent(handles.perfCounterOverflowEvent);
-    TERMINATE_IF_R_FAILED(r, "Clearing perf counter overflow event failed: %08X", r);
+    // Events of missing cores are created as well to keep the wait handles contiguous, they never signal
+    for (u32 core = 0; core < PMC_MAX_CORES; core++)
+    {
+        r = svcCreateEvent(&handles.perfCounterOverflowEvents[core], RESET_ONESHOT);
+        TERMINATE_IF_R_FAILED(r, "Creating perf counter overflow event failed: %08X", r);
+        r = svcClearEvent(handles.perfCounterOverflowEvents[core]);
+        TERMINATE_IF_R_FAILED(r, "Clearing perf counter overflow event failed: %08X", r);
+    }
 
     PMC_aquireControl();
 
-    waitHandlesActive++;
+    waitHandlesActive += PMC_MAX_CORES;
 
     PMC_useVirtualCounter(false);
 
-    r = svcBindInterrupt(0x78, handles.perfCounterOverflowEvent, 0, false);
-    TERMINATE_IF_R_FAILED(r, "Binding perf counter interrupt failed: %08X", r);
+    s64 isNew3DS = 0;
+    svcGetSystemInfo(&isNew3DS, 0x10000, 0x201);
+    pmcCoreCount = isNew3DS ? 4 : 2;
+
+    for (u32 core = 0; core < pmcCoreCount; core++)
+    {
+        r = svcBindInterrupt(PMC_INTERRUPT_BASE + core, handles.perfCounterOverflowEvents[core], 0, false);
+        TERMINATE_IF_R_FAILED(r, "Binding perf counter interrupt of core %lu failed: %08X", core, r);
+    }
+
+    PMC_initCoreWorkers();
+
+    sampleInterval = getConfiguredSampleInterval();
 
     PMC_setInterrupt();
     PMC_resetInterrupt();
@@ -204,12 +695,17 @@ void PMC_exit()
 {
     Result r;
 
-    r = svcUnbindInterrupt(0x78, handles.perfCounterOverflowEvent);
-    TERMINATE_IF_R_FAILED(r, "Unbinding perf counter interrupt failed: %08X", r);
+    PMC_exitCoreWorkers();
+
+    for (u32 core = 0; core < pmcCoreCount; core++)
+    {
+        r = svcUnbindInterrupt(PMC_INTERRUPT_BASE + core, handles.perfCounterOverflowEvents[core]);
+        TERMINATE_IF_R_FAILED(r, "Unbinding perf counter interrupt of core %lu failed: %08X", core, r);
+    }
 
     PMC_releaseControl();
 
-    waitHandlesActive--;
+    waitHandlesActive -= PMC_MAX_CORES;
 }
 
 void notificationsInit()
@@ -275,121 +771,613 @@ void handleNotification()
         LOG_ERROR("Unknown notification ID 0x%08X", notificationId);
 }
 
-void handlePerfCounterOverflow()
+void handlePerfCounterOverflow(u32 core)
 {
     Result r;
 
-    LOG_TRACE("Perf counter overflow event received");
+    LOG_TRACE("Perf counter overflow event received (core: %lu)", core);
 
-    if (!attached)
+    // Another core overflowed first, its break covers this one as all counters are reset on resume
+    if (!attached || breakPending)
         return;
 
+    overflowTick = svcGetSystemTick();
+    overflowCore = core;
+
+    overflowCountersRead = config.profile.counters && PMC_readCounters(core);
+
     r = svcBreakDebugProcess(handles.debuggeeProcess);
     if (R_FAILED(r))
     {
         LOG_WARNING("Breaking debuggee process failed: %08X", r);
         return;
     }
+
+    breakPending = true;
 }
 
-u32 stackBuffer[0x4000];
+bool readThreadStackWord(u32 addr, u32* out, void* arg)
+{
+    const AttachedThread* thread = arg;
 
-void handleDebuggeeProcessEvent()
+    if (addr & 3)
+        return false;
+
+    const u32* mapped = getMappedStack(thread, addr, sizeof(u32));
+    if (mapped)
+    {
+        *out = *mapped;
+        return true;
+    }
+
+    return R_SUCCEEDED(svcReadProcessMemory(out, handles.debuggeeProcess, addr, sizeof(u32)));
+}
+
+void recordChainSample(const AttachedThread* thread, const ThreadContext* context, const u32* chain, u32 chainCount)
+{
+    if (config.record.mode == CONFIG_RECORD_MODE_AGGREGATE)
+    {
+        aggregateAdd(thread->id, context->cpu_registers.pc, chain, chainCount);
+        return;
+    }
+
+    if (config.record.chainDictionary && chainCount <= CHAINS_MAX_CHAIN)
+    {
+        chainsRecordSample(thread->id, context->cpu_registers.pc, chain, chainCount);
+        return;
+    }
+
+    if (!recordEnsureSpace(sizeof(u32) * 5 + chainCount * sizeof(u32)))
+    {
+        recordDropSamples(1);
+        return;
+    }
+
+    recordHeader(RECORD_HEADER_SAMPLE_CHAIN);
+    recordU32(thread->id);
+    recordU32(context->cpu_registers.pc);
+    recordU32(context->cpu_registers.lr);
+    recordU32(chainCount);
+    recordData(chain, chainCount * sizeof(u32));
+}
+
+// Returns the stack of the thread from sp on, limited to the configured size
+const void* readThreadStack(const AttachedThread* thread, u32 sp, u32* size)
 {
     Result r;
-    DebugEventInfo info;
 
-    LOG_TRACE("Debuggee process event received");
+    // sp may be outside of the known stack, e.g. while running on a stack switched to by the thread itself
+    if (sp < thread->stackBottom || sp >= thread->stackTop)
+    {
+        *size = 0;
+        return NULL;
+    }
 
-    r = svcGetProcessDebugEvent(&info, handles.debuggeeProcess);
-    TERMINATE_IF_R_FAILED(r, "Getting debug event failed: %08X", r);
+    u32 stackSize = thread->stackTop - sp;
+    if (stackSize > sizeof(stackBuffer))
+        stackSize = sizeof(stackBuffer);
+    if (stackSize > config.profile.stackSize)
+        stackSize = config.profile.stackSize & ~3;
+
+    *size = stackSize;
+    if (stackSize == 0)
+        return NULL;
+
+    const void* stackData = getMappedStack(thread, sp, stackSize);
+    if (stackData == NULL)
+    {
+        r = svcReadProcessMemory(stackBuffer, handles.debuggeeProcess, sp, stackSize);
+        TERMINATE_IF_R_FAILED(r, "Reading debug thread stack failed: 0x%08X", r);
+        stackData = stackBuffer;
+    }
+
+    return stackData;
+}
+
+u32 filterReturnAddresses(const void* stackData, u32 stackSize, u32* chain, u32 maxCount)
+{
+    u32 chainCount = 0;
+
+    const u32* stackWords = (const u32*)stackData;
+    for (u32 j = 0; j < stackSize / sizeof(u32) && chainCount < maxCount; j++)
+    {
+        if (codeIsReturnAddress(stackWords[j]))
+            chain[chainCount++] = stackWords[j];
+    }
+
+    return chainCount;
+}
+
+// Call chain of a stopped thread outside of sampling, empty with raw stacks. Unwinding needs the GPRs in the context.
+u32 collectCallChain(AttachedThread* thread, const ThreadContext* context, u32* chain, u32 maxCount)
+{
+    if (config.profile.stackMode == CONFIG_STACK_MODE_UNWIND && unwindAvailable())
+    {
+        s32 chainCount = unwindChain(&context->cpu_registers, chain, maxCount, readThreadStackWord, thread);
+        if (chainCount >= 0)
+            return chainCount;
+    }
+
+    if (config.profile.stackMode == CONFIG_STACK_MODE_RAW)
+        return 0;
+
+    u32 stackSize;
+    const void* stackData = readThreadStack(thread, context->cpu_registers.sp, &stackSize);
+    return filterReturnAddresses(stackData, stackSize, chain, maxCount);
+}
+
+// Records the stack up to the part that is unchanged since the previous sample of the thread
+void recordDeltaSample(AttachedThread* thread, const ThreadContext* context, const void* stackData, u32 stackSize)
+{
+    const u32* stackWords = (const u32*)stackData;
+    u32* snapshot = getStackSnapshot(thread->stackSnapshotSlot);
+    u32 sp = context->cpu_registers.sp;
+    u32 end = sp + stackSize;
+    u32 wordCount = stackSize / sizeof(u32);
+    u32 suffixCount = 0;
+
+    // Keyframes have no unchanged part, the viewer can start decoding from any of them
+    bool keyframe = thread->stackSnapshotSize == 0 || thread->samplesSinceKeyframe >= config.profile.stackKeyframeInterval;
+    u32 snapshotEnd = thread->stackSnapshotSp + thread->stackSnapshotSize;
+    if (!keyframe && ((sp ^ thread->stackSnapshotSp) & 3) == 0 && end <= snapshotEnd && end > thread->stackSnapshotSp)
+    {
+        // Compared by address from the end, the deep part of the stack rarely changes
+        u32 snapshotIndex = (end - thread->stackSnapshotSp) / sizeof(u32);
+        while (suffixCount < wordCount && suffixCount < snapshotIndex &&
+               snapshot[snapshotIndex - 1 - suffixCount] == stackWords[wordCount - 1 - suffixCount])
+            suffixCount++;
+    }
+
+    u32 changedCount = wordCount - suffixCount;
+    if (!recordEnsureSpace(sizeof(u32) * 7 + changedCount * sizeof(u32)))
+    {
+        // The viewer misses this stack, so the next one must not refer to it
+        thread->stackSnapshotSize = 0;
+        recordDropSamples(1);
+        return;
+    }
+
+    recordHeader(RECORD_HEADER_SAMPLE_DELTA);
+    recordU32(thread->id);
+    recordU32(context->cpu_registers.pc);
+    recordU32(context->cpu_registers.lr);
+    recordU32(sp);
+    recordU32(stackSize);
+    recordU32(suffixCount);
+    if (changedCount > 0)
+        recordData(stackWords, changedCount * sizeof(u32));
+
+    if (stackSize > 0)
+        memcpy(snapshot, stackData, stackSize);
+    thread->stackSnapshotSp = sp;
+    thread->stackSnapshotSize = stackSize;
+    thread->samplesSinceKeyframe = keyframe ? 1 : thread->samplesSinceKeyframe + 1;
+}
+
+bool sampleThreadUnwind(AttachedThread* thread, const ThreadContext* context)
+{
+    u32 chain[UNWIND_MAX_DEPTH];
+
+    u64 statsStart = statsBegin();
+    s32 chainCount = unwindChain(&context->cpu_registers, chain, UNWIND_MAX_DEPTH, readThreadStackWord, thread);
+    statsEnd(STATS_PHASE_STACK, statsStart);
+    if (chainCount < 0)
+        return false;
+
+    statsStart = statsBegin();
+    recordChainSample(thread, context, chain, chainCount);
+    statsEnd(STATS_PHASE_RECORD, statsStart);
+
+    return true;
+}
+
+// Without a stack only the pc is recorded, in 8 bytes so very short sample intervals remain usable
+static inline bool isPcOnlySampling()
+{
+    return config.profile.stackSize < sizeof(u32) && config.profile.stackMode != CONFIG_STACK_MODE_UNWIND &&
+           config.record.mode != CONFIG_RECORD_MODE_AGGREGATE;
+}
 
-    if (info.type == DBGEVENT_OUTPUT_STRING)
+void samplePc(AttachedThread* thread)
+{
+    Result r;
+    ThreadContext context;
+
+    // Control registers are the smallest part of the context that holds the pc
+    r = svcGetDebugThreadContext(&context, handles.debuggeeProcess, thread->id, THREADCONTEXT_CONTROL_CPU_SPRS);
+    TERMINATE_IF_R_FAILED(r, "Getting debug thread context failed (thread ID: %u): %08X", thread->id, r);
+
+    if (!thread->slotRecorded)
+    {
+        if (!recordEnsureSpace(sizeof(u32) * 3))
+        {
+            recordDropSamples(1);
+            return;
+        }
+        recordHeader(RECORD_HEADER_THREAD_SLOT);
+        recordU32(thread->slot);
+        recordU32(thread->id);
+        thread->slotRecorded = true;
+    }
+
+    if (!recordEnsureSpace(sizeof(u32) * 2))
+    {
+        recordDropSamples(1);
+        return;
+    }
+    recordHeader((RecordHeader)(RECORD_HEADER_SAMPLE_PC | ((u32)thread->slot << 24)));
+    recordU32(context.cpu_registers.pc);
+}
+
+void sampleThread(AttachedThread* thread)
+{
+    Result r;
+    u32 stackSize;
+    ThreadContext context;
+
+    bool unwind = config.profile.stackMode == CONFIG_STACK_MODE_UNWIND && unwindAvailable();
+
+    u64 statsStart = statsBegin();
+    r = svcGetDebugThreadContext(&context, handles.debuggeeProcess, thread->id, THREADCONTEXT_CONTROL_CPU_SPRS | (unwind ? THREADCONTEXT_CONTROL_CPU_GPRS : 0));
+    TERMINATE_IF_R_FAILED(r, "Getting debug thread context failed (thread ID: %u): %08X", thread->id, r);
+    statsEnd(STATS_PHASE_CONTEXT, statsStart);
+    LOG_TRACE("Thread ID %lu - pc: 0x%08X, lr: 0x%08X, sp: 0x%08X", thread->id, context.cpu_registers.pc, context.cpu_registers.lr, context.cpu_registers.sp);
+
+    // Without unwind info for the pc the raw stack is recorded instead
+    if (unwind && sampleThreadUnwind(thread, &context))
+        return;
+
+    statsStart = statsBegin();
+    const void* stackData = readThreadStack(thread, context.cpu_registers.sp, &stackSize);
+    statsEnd(STATS_PHASE_STACK, statsStart);
+
+    statsStart = statsBegin();
+
+    // Aggregation needs a call chain, unwind fallbacks are filtered in that case
+    if (config.record.mode == CONFIG_RECORD_MODE_AGGREGATE)
+    {
+        u32 chain[AGGREGATE_MAX_CHAIN];
+        u32 chainCount = filterReturnAddresses(stackData, stackSize, chain, AGGREGATE_MAX_CHAIN);
+
+        recordChainSample(thread, &context, chain, chainCount);
+        statsEnd(STATS_PHASE_RECORD, statsStart);
+        return;
+    }
+
+    if (config.profile.stackMode != CONFIG_STACK_MODE_FILTERED && thread->stackSnapshotSlot >= 0)
+    {
+        recordDeltaSample(thread, &context, stackData, stackSize);
+        statsEnd(STATS_PHASE_RECORD, statsStart);
+        return;
+    }
+
+    if (config.profile.stackMode == CONFIG_STACK_MODE_FILTERED && config.record.chainDictionary)
+    {
+        // One more than fits the dictionary, longer chains are filtered into the record buffer below
+        u32 chain[CHAINS_MAX_CHAIN + 1];
+        u32 chainCount = filterReturnAddresses(stackData, stackSize, chain, CHAINS_MAX_CHAIN + 1);
+        if (chainCount <= CHAINS_MAX_CHAIN)
+        {
+            chainsRecordSample(thread->id, context.cpu_registers.pc, chain, chainCount);
+            statsEnd(STATS_PHASE_RECORD, statsStart);
+            return;
+        }
+    }
+
+    if (!recordEnsureSpace(sizeof(u32) * 5 + stackSize))
+    {
+        recordDropSamples(1);
+        return;
+    }
+
+    if (config.profile.stackMode == CONFIG_STACK_MODE_FILTERED)
+    {
+        recordHeader(RECORD_HEADER_SAMPLE_CHAIN);
+        recordU32(thread->id);
+        recordU32(context.cpu_registers.pc);
+        recordU32(context.cpu_registers.lr);
+
+        // Candidates are filtered straight into the record buffer, count is patched afterwards
+        u32* chainCount = (u32*)recordHead;
+        recordU32(0);
+
+        const u32* stackWords = (const u32*)stackData;
+        for (u32 j = 0; j < stackSize / sizeof(u32); j++)
+        {
+            if (codeIsReturnAddress(stackWords[j]))
+            {
+                recordU32(stackWords[j]);
+                (*chainCount)++;
+            }
+        }
+    }
+    else
+    {
+        recordHeader(RECORD_HEADER_SAMPLE);
+        recordU32(thread->id);
+        recordU32(context.cpu_registers.pc);
+        recordU32(context.cpu_registers.lr);
+        recordU32(stackSize);
+        if (stackSize > 0)
+            recordData(stackData, stackSize);
+    }
+
+    statsEnd(STATS_PHASE_RECORD, statsStart);
+}
+
+void recordSchedule(RecordHeader header, u32 threadId, const ScheduleInOutEvent* event)
+{
+    if (!recordEnsureSpace(sizeof(u32) * 5))
+        return;
+    recordHeader(header);
+    recordU32(threadId);
+    recordU32(event->cpu_id);
+    // Records are only word aligned
+    recordU32((u32)event->clock_tick);
+    recordU32((u32)(event->clock_tick >> 32));
+}
+
+void recordSyscallIn(u32 threadId, const SyscallInOutEvent* event)
+{
+    Result r;
+    ThreadContext context;
+
+    // Syscalls are made from small wrappers, lr is needed to find the actual caller
+    r = svcGetDebugThreadContext(&context, handles.debuggeeProcess, threadId, THREADCONTEXT_CONTROL_CPU_SPRS);
+    if (R_FAILED(r))
+    {
+        context.cpu_registers.pc = 0;
+        context.cpu_registers.lr = 0;
+    }
+
+    if (!recordEnsureSpace(sizeof(u32) * 7))
+        return;
+    recordHeader(RECORD_HEADER_SYSCALL_IN);
+    recordU32(threadId);
+    recordU32(event->syscall);
+    recordU32((u32)event->clock_tick);
+    recordU32((u32)(event->clock_tick >> 32));
+    recordU32(context.cpu_registers.pc);
+    recordU32(context.cpu_registers.lr);
+}
+
+void recordSyscallOut(u32 threadId, const SyscallInOutEvent* event)
+{
+    if (!recordEnsureSpace(sizeof(u32) * 5))
+        return;
+    recordHeader(RECORD_HEADER_SYSCALL_OUT);
+    recordU32(threadId);
+    recordU32(event->syscall);
+    recordU32((u32)event->clock_tick);
+    recordU32((u32)(event->clock_tick >> 32));
+}
+
+#define SYSCALL_CLOSE_HANDLE        0x23
+#define SYSCALL_SEND_SYNC_REQUEST   0x32
+
+#define IPC_MAX_CHAIN 0x10
+
+void recordIpcRequest(u32 threadId, const SyscallInOutEvent* event)
+{
+    Result r;
+    ThreadContext context;
+    u32 commandHeader = 0;
+    u32 chain[IPC_MAX_CHAIN];
+    u32 chainCount = 0;
+
+    AttachedThread* thread = getAttachedThread(threadId);
+    if (thread == NULL)
+        return;
+
+    r = svcGetDebugThreadContext(&context, handles.debuggeeProcess, threadId, THREADCONTEXT_CONTROL_CPU_SPRS | THREADCONTEXT_CONTROL_CPU_GPRS);
+    if (R_FAILED(r))
+    {
+        LOG_WARNING("Getting IPC thread context failed (thread ID: %lu): %08X", threadId, r);
+        return;
+    }
+
+    // The session handle is passed in r0, the command sits in the IPC buffer of the thread
+    Handle session = context.cpu_registers.r[0];
+    svcReadProcessMemory(&commandHeader, handles.debuggeeProcess, thread->tls + 0x80, sizeof(commandHeader));
+    serviceResolve(session);
+
+    chainCount = collectCallChain(thread, &context, chain, IPC_MAX_CHAIN);
+
+    if (!recordEnsureSpace(sizeof(u32) * 8 + chainCount * sizeof(u32)))
+        return;
+    recordHeader(RECORD_HEADER_IPC_REQUEST);
+    recordU32(threadId);
+    recordU32(session);
+    recordU32(commandHeader);
+    recordU32((u32)event->clock_tick);
+    recordU32((u32)(event->clock_tick >> 32));
+    recordU32(context.cpu_registers.lr);
+    recordU32(chainCount);
+    recordData(chain, chainCount * sizeof(u32));
+}
+
+void recordIpcReply(u32 threadId, const SyscallInOutEvent* event)
+{
+    if (!recordEnsureSpace(sizeof(u32) * 4))
+        return;
+    recordHeader(RECORD_HEADER_IPC_REPLY);
+    recordU32(threadId);
+    recordU32((u32)event->clock_tick);
+    recordU32((u32)(event->clock_tick >> 32));
+}
+
+void forgetClosedHandle(u32 threadId)
+{
+    Result r;
+    ThreadContext context;
+
+    r = svcGetDebugThreadContext(&context, handles.debuggeeProcess, threadId, THREADCONTEXT_CONTROL_CPU_GPRS);
+    if (R_SUCCEEDED(r))
+        serviceForget(context.cpu_registers.r[0]);
+}
+
+void handleDebugEvent(const DebugEventInfo* info)
+{
+    Result r;
+
+    if (info->type == DBGEVENT_OUTPUT_STRING)
     {
         char buffer[0x101];
         memset(buffer, 0, sizeof(buffer));
 
-        r = svcReadProcessMemory(buffer, handles.debuggeeProcess, info.output_string.string_addr, info.output_string.string_size);
+        r = svcReadProcessMemory(buffer, handles.debuggeeProcess, info->output_string.string_addr, info->output_string.string_size);
         TERMINATE_IF_R_FAILED(r, "Reading debug output string failed: %08X", r);
 
         LOG_INFO("Debug output: %s", buffer);
     }
-    else if (info.type == DBGEVENT_EXCEPTION)
+    else if (info->type == DBGEVENT_EXCEPTION)
     {
-        if (info.exception.type == EXCEVENT_ATTACH_BREAK)
+        if (info->exception.type == EXCEVENT_ATTACH_BREAK)
         {
             LOG_INFO("Debuggee process attach break");
             
             attached = true;
-            recordInit();
+
+            RecordSession session = {
+                .programId = debuggeeProgramId,
+                .startTick = svcGetSystemTick(),
+                .sampleInterval = getConfiguredSampleInterval(),
+            };
+            memcpy(session.processName, debuggeeProcessName, sizeof(session.processName));
+            recordInit(&session);
+
+            statsInit();
+            chainsInit();
+
+            if (config.record.mode == CONFIG_RECORD_MODE_AGGREGATE)
+                aggregateInit(recordArena, recordArenaSize);
+
+            initSampleInterval();
+
+            if (config.profile.stackMode != CONFIG_STACK_MODE_RAW)
+                codeInit(handles.debuggeeProcess, debuggeeProcessHandle);
+            if (config.profile.stackMode == CONFIG_STACK_MODE_UNWIND)
+                unwindInit(handles.debuggeeProcess, debuggeeProcessHandle);
+
+            moduleInit(handles.debuggeeProcess);
+            frameInit(handles.debuggeeProcess, config.profile.frameAddress);
+
+            if (config.record.ipc)
+                serviceInit(debuggeeProcessHandle);
 
             PMC_resetInterrupt();
         }
-        else if (info.exception.type == EXCEVENT_DEBUGGER_BREAK)
+        else if (info->exception.type == EXCEVENT_DEBUGGER_BREAK)
         {
-            u32 threadId;
-            u32 stackSize;
-            ThreadContext context;
+            if (statsEnabled)
+                statsAdd(STATS_PHASE_BREAK, svcGetSystemTick() - overflowTick);
 
             size_t sendThreadCount = attachedThreadCount;
             if (config.profile.maxThreads > 0 && sendThreadCount > config.profile.maxThreads)
                 sendThreadCount = config.profile.maxThreads;
 
-            for (size_t i = 0; i < sendThreadCount; i++)
+            if (sampleIntervalDropped)
+                recordSampleInterval();
+
+            // Code turning executable is picked up before the stacks of this break are filtered
+            moduleCheckPending();
+
+            // Applies to the samples of this break, aggregated samples carry no time or counters.
+            // Without it the samples would be attributed to the previous break, so they are dropped as well.
+            bool breakRecorded = true;
+            if (config.record.mode != CONFIG_RECORD_MODE_AGGREGATE)
+            {
+                breakRecorded = recordBreak();
+                if (breakRecorded && overflowCountersRead)
+                    recordCounters(info->exception.debugger_break.thread_ids[overflowCore]);
+            }
+
+            // Threads on a core at the time of the break may not have a schedule in event yet
+            for (size_t i = 0; i < 4; i++)
             {
-                threadId = attachedThreads[i].id;
-
-                r = svcGetDebugThreadContext(&context, handles.debuggeeProcess, threadId, THREADCONTEXT_CONTROL_CPU_SPRS);
-                TERMINATE_IF_R_FAILED(r, "Getting debug thread context failed (thread ID: %u): %08X", threadId, r);
-                LOG_TRACE("Thread ID %lu - pc: 0x%08X, lr: 0x%08X, sp: 0x%08X", threadId, context.cpu_registers.pc, context.cpu_registers.lr, context.cpu_registers.sp);
-
-                stackSize = attachedThreads[i].stackTop - context.cpu_registers.sp;
-                if (stackSize > sizeof(stackBuffer))
-                    stackSize = sizeof(stackBuffer);
-                if (stackSize > config.profile.stackSize)
-                    stackSize = config.profile.stackSize & ~3;
-                
-                if (stackSize > 0)
-                {
-                    r = svcReadProcessMemory(stackBuffer, handles.debuggeeProcess, context.cpu_registers.sp, stackSize);
-                    TERMINATE_IF_R_FAILED(r, "Reading debug thread stack failed: 0x%08X", r);
-                }
-
-                recordEnsureSpace(sizeof(u32) * 5 + stackSize);
-
-                recordHeader(RECORD_HEADER_SAMPLE);
-                recordU32(threadId);
-                recordU32(context.cpu_registers.pc);
-                recordU32(context.cpu_registers.lr);
-                recordU32(stackSize);
-                if (stackSize > 0)
-                    recordData(stackBuffer, stackSize);
+                AttachedThread* thread = getAttachedThread(info->exception.debugger_break.thread_ids[i]);
+                if (thread)
+                    thread->ranSinceSample = true;
             }
 
+            size_t sentThreadCount = 0;
+            for (size_t i = 0; i < attachedThreadCount && sentThreadCount < sendThreadCount; i++)
+            {
+                AttachedThread* thread = &attachedThreads[i];
+                if (config.profile.runningOnly && !thread->ranSinceSample)
+                    continue;
+
+                if (!breakRecorded)
+                    recordDropSamples(1);
+                else if (isPcOnlySampling())
+                    samplePc(thread);
+                else
+                    sampleThread(thread);
+                statsCountSample();
+                sentThreadCount++;
+
+                thread->ranSinceSample = thread->running;
+            }
+
+            if (statsEnabled)
+                statsAdd(STATS_PHASE_SAMPLE, svcGetSystemTick() - overflowTick);
+            statsUpdate();
+
+            adaptSampleInterval(svcGetSystemTick());
+            breakPending = false;
             PMC_resetInterrupt();
         }
+        else if (info->exception.type == EXCEVENT_STOP_POINT && info->exception.stop_point.type == STOPPOINT_BREAKPOINT &&
+                 frameHandleBreakpoint(info->thread_id, info->exception.address))
+        {
+            LOG_TRACE("Frame breakpoint hit (thread ID: %lu)", info->thread_id);
+        }
         else
         {
-            LOG_WARNING("Unhandled debuggee process exception (type: %d)", info.exception.type);
+            LOG_WARNING("Unhandled debuggee process exception (type: %d)", info->exception.type);
         }
     }
-    else if (info.type == DBGEVENT_ATTACH_PROCESS)
+    else if (info->type == DBGEVENT_ATTACH_PROCESS)
     {
-        LOG_INFO("Debuggee process attached (process ID: %u)", info.attach_process.process_id);
-        LOG_INFO(" Program ID: %016lX", info.attach_process.program_id);
-        LOG_INFO(" Name: %.8s", info.attach_process.process_name);
+        LOG_INFO("Debuggee process attached (process ID: %u)", info->attach_process.process_id);
+        LOG_INFO(" Program ID: %016lX", info->attach_process.program_id);
+        LOG_INFO(" Name: %.8s", info->attach_process.process_name);
+
+        debuggeeProgramId = info->attach_process.program_id;
+        memcpy(debuggeeProcessName, info->attach_process.process_name, sizeof(debuggeeProcessName));
+
+        r = svcOpenProcess(&debuggeeProcessHandle, info->attach_process.process_id);
+        if (R_FAILED(r))
+        {
+            LOG_WARNING("Opening debuggee process failed, stacks and code will not be mapped: %08X", r);
+            debuggeeProcessHandle = 0;
+        }
     }
-    else if (info.type == DBGEVENT_EXIT_PROCESS)
+    else if (info->type == DBGEVENT_EXIT_PROCESS)
     {
-        LOG_INFO("Debuggee process exited (reason: %s)", processExitReasons[info.exit_process.reason]);
+        LOG_INFO("Debuggee process exited (reason: %s)", processExitReasons[info->exit_process.reason]);
 
         svcCloseHandle(handles.debuggeeProcess);
         handles.debuggeeProcess = 0;
         waitHandlesActive--;
 
+        frameExit();
+        serviceExit();
+        moduleExit();
+        aggregateExit();
+        statsExit();
         recordExit();
         attached = false;
-        attachedThreadCount = 0;
+        breakPending = false;
+        removeAllAttachedThreads();
+        unwindExit();
+        codeExit();
+
+        if (debuggeeProcessHandle != 0)
+        {
+            svcCloseHandle(debuggeeProcessHandle);
+            debuggeeProcessHandle = 0;
+        }
 
         r = PMDBG_LumaDebugNextApplicationByForce(true);
         TERMINATE_IF_R_FAILED(r, "Enabling Luma debug next application by force failed: %08X", r);
@@ -399,36 +1387,105 @@ void handleDebuggeeProcessEvent()
         // Do not continue even though the flag is set, the process is gone.
         return;
     }
-    else if (info.type == DBGEVENT_ATTACH_THREAD)
+    else if (info->type == DBGEVENT_ATTACH_THREAD)
     {
         ThreadContext context;
 
-        LOG_INFO("Debuggee process thread attached (thread ID: %u)", info.thread_id);
-        LOG_INFO(" Creator thread ID: %u", info.attach_thread.creator_thread_id);
-        LOG_INFO(" TLS: 0x%08X", info.attach_thread.thread_local_storage);
-        // info.attached_thread.entry_point is always 0x100000?
+        LOG_INFO("Debuggee process thread attached (thread ID: %u)", info->thread_id);
+        LOG_INFO(" Creator thread ID: %u", info->attach_thread.creator_thread_id);
+        LOG_INFO(" TLS: 0x%08X", info->attach_thread.thread_local_storage);
+        // info->attached_thread.entry_point is always 0x100000?
 
-        r = svcGetDebugThreadContext(&context, handles.debuggeeProcess, info.thread_id, THREADCONTEXT_CONTROL_CPU_SPRS | THREADCONTEXT_CONTROL_CPU_GPRS);
+        r = svcGetDebugThreadContext(&context, handles.debuggeeProcess, info->thread_id, THREADCONTEXT_CONTROL_CPU_SPRS | THREADCONTEXT_CONTROL_CPU_GPRS);
         TERMINATE_IF_R_FAILED(r, "Getting debug thread context failed: %08X", r);
 
         LOG_INFO(" Thread pc: 0x%08X", context.cpu_registers.pc);
         LOG_INFO(" Thread sp: 0x%08X", context.cpu_registers.sp);
 
-        addAttachedThread(info.thread_id, context.cpu_registers.pc, context.cpu_registers.sp);
+        addAttachedThread(info->thread_id, context.cpu_registers.pc, context.cpu_registers.sp, info->attach_thread.thread_local_storage);
     }
-    else if (info.type == DBGEVENT_EXIT_THREAD)
+    else if (info->type == DBGEVENT_EXIT_THREAD)
     {
-        LOG_INFO("Debuggee process thread exited (thread ID: %u, reason: %s)", info.thread_id, threadExitReasons[info.exit_thread.reason]);
+        LOG_INFO("Debuggee process thread exited (thread ID: %u, reason: %s)", info->thread_id, threadExitReasons[info->exit_thread.reason]);
 
-        removeAttachedThread(info.thread_id);
+        removeAttachedThread(info->thread_id);
     } 
+    else if (info->type == DBGEVENT_SCHEDULE_IN)
+    {
+        AttachedThread* thread = getAttachedThread(info->thread_id);
+        if (thread)
+        {
+            thread->running = true;
+            thread->ranSinceSample = true;
+        }
+
+        if (attached && config.record.schedule)
+            recordSchedule(RECORD_HEADER_SCHEDULE_IN, info->thread_id, &info->scheduler);
+    }
+    else if (info->type == DBGEVENT_SCHEDULE_OUT)
+    {
+        AttachedThread* thread = getAttachedThread(info->thread_id);
+        if (thread)
+            thread->running = false;
+
+        if (attached && config.record.schedule)
+            recordSchedule(RECORD_HEADER_SCHEDULE_OUT, info->thread_id, &info->scheduler);
+    }
+    else if (info->type == DBGEVENT_MAP)
+    {
+        if (attached)
+            moduleMapped(info->map.mapped_addr, info->map.mapped_size, info->map.memperm, info->map.memstate);
+    }
+    else if (info->type == DBGEVENT_SYSCALL_IN)
+    {
+        if (attached && config.record.syscalls)
+            recordSyscallIn(info->thread_id, &info->syscall);
+
+        if (attached && config.record.ipc)
+        {
+            if (info->syscall.syscall == SYSCALL_SEND_SYNC_REQUEST)
+                recordIpcRequest(info->thread_id, &info->syscall);
+            else if (info->syscall.syscall == SYSCALL_CLOSE_HANDLE)
+                forgetClosedHandle(info->thread_id);
+        }
+    }
+    else if (info->type == DBGEVENT_SYSCALL_OUT)
+    {
+        if (attached && config.record.syscalls)
+            recordSyscallOut(info->thread_id, &info->syscall);
+
+        if (attached && config.record.ipc && info->syscall.syscall == SYSCALL_SEND_SYNC_REQUEST)
+            recordIpcReply(info->thread_id, &info->syscall);
+    }
+}
+
+void handleDebuggeeProcessEvent()
+{
+    Result r;
+    DebugEventInfo info;
+    bool stopped = false;
+
+    LOG_TRACE("Debuggee process event received");
+
+    r = svcGetProcessDebugEvent(&info, handles.debuggeeProcess);
+    TERMINATE_IF_R_FAILED(r, "Getting debug event failed: %08X", r);
+
+    // Events queued meanwhile are handled as well, so a burst of them is continued from only once
+    do
+    {
+        handleDebugEvent(&info);
+        stopped |= (info.flags & 1) != 0;
+    } while (handles.debuggeeProcess != 0 && R_SUCCEEDED(svcGetProcessDebugEvent(&info, handles.debuggeeProcess)));
 
-    if (info.flags & 1)
+    if (stopped && handles.debuggeeProcess != 0)
     {
         r = svcContinueDebugEvent(handles.debuggeeProcess, DBG_SIGNAL_SCHEDULE_EVENTS | DBG_SIGNAL_SYSCALL_EVENTS | DBG_SIGNAL_MAP_EVENTS);
         if (R_FAILED(r))
             LOG_WARNING("Continuing debug event failed: %08X", r);
     }
+
+    if (attached)
+        recordFlushDeferred();
 }
 
 int main()
@@ -478,6 +1535,9 @@ int main()
     atexit(PMC_exit);
 
     atexit(recordExit);
+    atexit(statsExit);
+    atexit(aggregateExit);
+    atexit(frameExit);
 
     r = PMDBG_LumaDebugNextApplicationByForce(true);
     TERMINATE_IF_R_FAILED(r, "Enabling Luma debug next application by force failed: %08X", r);
@@ -488,26 +1548,31 @@ int main()
     while (!terminationRequested)
     {
         LOG_TRACE("Waiting for synchronization event...");
-        r = svcWaitSynchronizationN(&idx, handles.wait, waitHandlesActive, false, -1LL);
+        u64 statsStart = attached ? statsBegin() : 0;
+        s64 timeout = attached ? aggregateFlushTimeout() : -1LL;
+        r = svcWaitSynchronizationN(&idx, handles.wait, waitHandlesActive, false, timeout);
         TERMINATE_IF_R_FAILED(r, "Waiting for synchronization failed: %08X", r);
+        statsEnd(STATS_PHASE_WAIT, statsStart);
+
+        if (R_DESCRIPTION(r) == RD_TIMEOUT)
+        {
+            // The debuggee is running, so the aggregated samples can be written out right away
+            LOG_TRACE("Synchronization timed out, flushing aggregated samples");
+            aggregateFlushIfDue();
+            recordFlush();
+            continue;
+        }
 
         LOG_TRACE("Synchronization event %d signaled", idx);
 
-        switch (idx)
-        {
-        case 0:
+        if (idx == 0)
             handleNotification();
-            break;
-        case 1:
-            handlePerfCounterOverflow();
-            break;
-        case 2:
+        else if (idx <= PMC_MAX_CORES)
+            handlePerfCounterOverflow(idx - 1);
+        else if (idx == PMC_MAX_CORES + 1)
             handleDebuggeeProcessEvent();
-            break;
-        default:
+        else
             LOG_ERROR("Unknown synchronization index %d", idx);
-            break;
-        }
     }
 
     LOG_INFO("Termination requested, exiting...");
@@ -0,0 +1,172 @@
+#include "module.h"
+#include "code.h"
+#include "record.h"
+#include "log.h"
+
+#include <string.h>
+
+#define MODULE_QUERY_START  0x00100000
+#define MODULE_QUERY_END    0x40000000
+
+// CROs are mapped writable and only made executable afterwards, without a map event for that.
+// Such regions are checked again on every break until they turn executable or too many checks passed.
+#define MODULE_MAX_PENDING      0x10
+#define MODULE_PENDING_CHECKS   0x100
+
+// CRO header fields, offsets are rebased to addresses once the module is loaded
+#define CRO_MAGIC_OFFSET        0x80
+#define CRO_NAME_OFFSET_OFFSET  0xC0
+#define CRO_NAME_SIZE_OFFSET    0xC4
+
+typedef struct
+{
+    u32 addr;
+    u32 size;
+    u32 checks;
+} ModulePending;
+
+static Handle moduleDebug = 0;
+static ModulePending modulePending[MODULE_MAX_PENDING];
+static size_t modulePendingCount = 0;
+
+static void moduleReadName(u32 addr, u32 size, char* name)
+{
+    u32 magic = 0;
+    u32 nameAddr = 0;
+    u32 nameSize = 0;
+
+    memset(name, 0, MODULE_NAME_LENGTH);
+
+    if (size < CRO_NAME_SIZE_OFFSET + sizeof(u32))
+        return;
+    if (R_FAILED(svcReadProcessMemory(&magic, moduleDebug, addr + CRO_MAGIC_OFFSET, sizeof(magic))) || magic != 0x304F5243)  // "CRO0"
+        return;
+    if (R_FAILED(svcReadProcessMemory(&nameAddr, moduleDebug, addr + CRO_NAME_OFFSET_OFFSET, sizeof(nameAddr))) ||
+        R_FAILED(svcReadProcessMemory(&nameSize, moduleDebug, addr + CRO_NAME_SIZE_OFFSET, sizeof(nameSize))))
+        return;
+
+    if (nameAddr < size)
+        nameAddr += addr;
+    if (nameSize > MODULE_NAME_LENGTH)
+        nameSize = MODULE_NAME_LENGTH;
+    if (nameSize == 0 || R_FAILED(svcReadProcessMemory(name, moduleDebug, nameAddr, nameSize)))
+        memset(name, 0, MODULE_NAME_LENGTH);
+}
+
+static void moduleRecord(u32 addr, u32 size, u32 perm, u32 state)
+{
+    char name[MODULE_NAME_LENGTH];
+    moduleReadName(addr, size, name);
+
+    LOG_INFO("Module 0x%08X-0x%08X (perm: %lu, state: %lu) %.16s", addr, addr + size, perm, state, name);
+
+    if (!recordEnsureSpace(sizeof(u32) * 5 + MODULE_NAME_LENGTH))
+        return;
+    recordHeader(RECORD_HEADER_MODULE);
+    recordU32(addr);
+    recordU32(size);
+    recordU32(perm);
+    recordU32(state);
+    recordData(name, MODULE_NAME_LENGTH);
+}
+
+static void moduleAddCode(u32 addr, u32 size, u32 perm, u32 state)
+{
+    moduleRecord(addr, size, perm, state);
+
+    // Return address filtering has to know about new code as well
+    codeAddRange(addr, addr + size);
+}
+
+void moduleInit(Handle debug)
+{
+    Result r;
+    MemInfo memInfo;
+    PageInfo pageInfo;
+
+    moduleDebug = debug;
+
+    u32 addr = MODULE_QUERY_START;
+    while (addr < MODULE_QUERY_END)
+    {
+        r = svcQueryDebugProcessMemory(&memInfo, &pageInfo, debug, addr);
+        if (R_FAILED(r) || memInfo.size == 0)
+            break;
+
+        if (memInfo.perm & MEMPERM_EXECUTE)
+            moduleRecord(memInfo.base_addr, memInfo.size, memInfo.perm, memInfo.state);
+
+        addr = memInfo.base_addr + memInfo.size;
+    }
+}
+
+void moduleExit()
+{
+    moduleDebug = 0;
+    modulePendingCount = 0;
+}
+
+void moduleMapped(u32 addr, u32 size, u32 perm, u32 state)
+{
+    if (moduleDebug == 0)
+        return;
+
+    if (perm & MEMPERM_EXECUTE)
+    {
+        moduleAddCode(addr, size, perm, state);
+        return;
+    }
+
+    if (modulePendingCount >= MODULE_MAX_PENDING)
+    {
+        memmove(&modulePending[0], &modulePending[1], sizeof(modulePending[0]) * (MODULE_MAX_PENDING - 1));
+        modulePendingCount--;
+    }
+    modulePending[modulePendingCount++] = (ModulePending){
+        .addr = addr,
+        .size = size,
+        .checks = 0,
+    };
+}
+
+// Returns true if executable parts were found in the region
+static bool moduleCheckRegion(u32 addr, u32 end)
+{
+    Result r;
+    MemInfo memInfo;
+    PageInfo pageInfo;
+    bool found = false;
+
+    while (addr < end)
+    {
+        r = svcQueryDebugProcessMemory(&memInfo, &pageInfo, moduleDebug, addr);
+        if (R_FAILED(r) || memInfo.size == 0)
+            break;
+
+        if (memInfo.perm & MEMPERM_EXECUTE)
+        {
+            moduleAddCode(memInfo.base_addr, memInfo.size, memInfo.perm, memInfo.state);
+            found = true;
+        }
+
+        addr = memInfo.base_addr + memInfo.size;
+    }
+
+    return found;
+}
+
+void moduleCheckPending()
+{
+    size_t i = 0;
+    while (i < modulePendingCount)
+    {
+        ModulePending* pending = &modulePending[i];
+        if (moduleCheckRegion(pending->addr, pending->addr + pending->size) || ++pending->checks >= MODULE_PENDING_CHECKS)
+        {
+            memmove(&modulePending[i], &modulePending[i + 1], sizeof(modulePending[0]) * (modulePendingCount - i - 1));
+            modulePendingCount--;
+            continue;
+        }
+        i++;
+    }
+}
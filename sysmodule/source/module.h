@@ -0,0 +1,15 @@
+#pragma once
+
+#include <3ds.h>
+
+
+#define MODULE_NAME_LENGTH 0x10
+
+// Records the executable regions present at attach
+void moduleInit(Handle debug);
+void moduleExit();
+
+// Records a region mapped into the debuggee later on if it is executable, e.g. a loaded CRO.
+// Other regions are only recorded once moduleCheckPending finds them reprotected as executable.
+void moduleMapped(u32 addr, u32 size, u32 perm, u32 state);
+void moduleCheckPending();
@@ -1,8 +1,11 @@
 #include "record.h"
+#include "compress.h"
+#include "stats.h"
 #include "log.h"
 #include "config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
@@ -15,28 +18,177 @@
 #define RECORD_FILE_WRITE_CHUNK_SIZE (0x4000)
 #define RECORD_NETWORK_SEND_CHUNK_SIZE (0x1000)
 
+// In aggregate mode most of the buffer holds the aggregation table instead of packets
+#define RECORD_AGGREGATE_ARENA_SIZE (RECORD_BUFFER_SIZE - RECORD_BUFFER_SIZE / 4)
+
+// A raw sample with the largest stack has to fit into one segment
+#define RECORD_SEGMENT_SIZE_MIN (0x10000 + 0x1000)
+#define RECORD_SEGMENT_COUNT_MAX 0x20
+
 u8 recordBuffer[RECORD_BUFFER_SIZE];
+u32 recordBufferSize = RECORD_BUFFER_SIZE;
+
+u8* recordArena = NULL;
+u32 recordArenaSize = 0;
 
 u8* recordBase = NULL;
 u8* recordHead = NULL;
 u8* recordEnd = NULL;
 
-Thread recordThread = NULL;
-LightEvent recordThreadFlushRequestEvent;
+// Frame header: 'N', 'Z', u16 flags, u32 raw size, u32 data size
+#define RECORD_FRAME_HEADER_SIZE (sizeof(u32) * 3)
+#define RECORD_FRAME_FLAG_STORED 1
+
+// Segments are at most half the buffer
+#define RECORD_SEGMENT_FRAME_COUNT_MAX ((RECORD_BUFFER_SIZE / 2 + COMPRESS_BLOCK_SIZE - 1) / COMPRESS_BLOCK_SIZE)
+
+typedef struct
+{
+    u16 flags;
+    u32 rawSize;
+    u32 size;
+} RecordFrame;
+
+// With record threads the buffer is a ring of segments, filled by the sampling path and drained by one thread per sink.
+// Each counter is only written by one side, the segment at filled is the one currently being written to.
+// With compression each segment is compressed once in place, the frame data of every block starts at the block.
+typedef struct
+{
+    u8* base;
+    u32 size;
+    u32 frameCount;
+    RecordFrame frames[RECORD_SEGMENT_FRAME_COUNT_MAX];
+} RecordSegment;
+
+RecordSegment recordSegments[RECORD_SEGMENT_COUNT_MAX];
+u32 recordSegmentCount = 0;
+u32 recordSegmentSize = 0;
+u32 recordSegmentsFilled = 0;
+u32 recordSegmentsCompressed = 0;
+LightLock recordCompressLock;
+
+// Only allocated with compression enabled
+CompressState* recordCompressState = NULL;
+u8* recordFrameBuffer = NULL;
+
+typedef enum
+{
+    RECORD_SINK_FILE,
+    RECORD_SINK_SOCKET,
+    RECORD_SINK_COUNT,
+} RecordSinkId;
+
+#define RECORD_SINKS_ALL (BIT(RECORD_SINK_COUNT) - 1)
+
+// Each sink drains the ring on its own thread, so a slow sink only holds back the other one once the ring is full
+typedef struct
+{
+    Thread thread;
+    LightEvent flushRequestEvent;
+    u32 drained;
+} RecordSink;
+
+RecordSink recordSinks[RECORD_SINK_COUNT];
+
+// The exheader only allows cores 0 and 1 and the debuggee runs on core 0.
+// Both sink threads share core 1, they mostly wait on the SD card or the network.
+#define RECORD_THREAD_CORE 1
+
+bool recordThreaded = false;
 LightEvent recordThreadFlushDoneEvent;
 volatile bool recordThreadShouldExit = false;
-u8* recordThreadFlushBase = NULL;
-u32 recordThreadFlushSize = 0;
 
 FILE* recordFile = NULL;
 int recordSocket = -1;
 
+u32 recordDroppedPackets = 0;
+u32 recordDroppedSamples = 0;
+
 void recordThreadFunc(void* arg);
+void recordInitSegments();
+void recordFlushData(const u8* data, u32 size);
+bool recordPassSegment(bool wait);
+void recordDropped();
+
+void recordConnect()
+{
+    struct addrinfo hints;
+    struct addrinfo* res = NULL;
+    char portStr[8];
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    snprintf(portStr, sizeof(portStr), "%u", config.network.portTcp);
+
+    if (getaddrinfo(config.network.host, portStr, &hints, &res) != 0 || res == NULL)
+    {
+        LOG_ERROR("Failed to resolve record host");
+        return;
+    }
 
-void recordInit()
+    LOG_INFO("Connecting to record host: %s:%s", config.network.host, portStr);
+    for (struct addrinfo* rp = res; rp != NULL; rp = rp->ai_next)
+    {
+        recordSocket = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (recordSocket < 0)
+            continue;       
+
+        if (connect(recordSocket, rp->ai_addr, rp->ai_addrlen) == 0)
+        {
+            LOG_INFO("Connected to record host: %s:%s", config.network.host, portStr);
+            break;
+        }
+
+        close(recordSocket);
+        recordSocket = -1;
+    }
+
+    if (recordSocket < 0)
+        LOG_ERROR("Failed to connect record socket");
+
+    freeaddrinfo(res);
+}
+
+void recordSessionHeader(const RecordSession* session)
+{
+    if (!recordEnsureSpace(sizeof(u32) * 11))
+        return;
+    recordHeader(RECORD_HEADER_SESSION);
+    // Version goes first so readers can reject captures before parsing the rest
+    recordU32(RECORD_FORMAT_VERSION);
+    recordU32(SYSCLOCK_ARM11);
+    recordU32((u32)session->programId);
+    recordU32((u32)(session->programId >> 32));
+    recordData(session->processName, sizeof(session->processName));
+    recordU32((u32)session->startTick);
+    recordU32((u32)(session->startTick >> 32));
+    recordU32(session->sampleInterval);
+    recordU32(config.profile.stackSize);
+}
+
+void recordInit(const RecordSession* session)
 {
     recordExit();
 
+    if (config.record.mode == CONFIG_RECORD_MODE_AGGREGATE)
+    {
+        recordBufferSize = RECORD_BUFFER_SIZE - RECORD_AGGREGATE_ARENA_SIZE;
+        recordArena = recordBuffer + recordBufferSize;
+        recordArenaSize = RECORD_AGGREGATE_ARENA_SIZE;
+    }
+    else
+    {
+        recordBufferSize = RECORD_BUFFER_SIZE;
+        recordArena = NULL;
+        recordArenaSize = 0;
+    }
+
+    recordDroppedPackets = 0;
+    recordDroppedSamples = 0;
+
     if (config.record.file && recordFile == NULL)
     {
         mkdir("/nextprof", 0777);
@@ -57,53 +209,29 @@ void recordInit()
     }
 
     if (config.record.tcp && recordSocket < 0)
-    {
-        struct addrinfo hints;
-        struct addrinfo* res = NULL;
-        char portStr[8];
-
-        memset(&hints, 0, sizeof(hints));
-        hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_STREAM;
-        hints.ai_protocol = IPPROTO_TCP;
+        recordConnect();
 
-        snprintf(portStr, sizeof(portStr), "%u", config.network.portTcp);
-
-        if (getaddrinfo(config.network.host, portStr, &hints, &res) != 0 || res == NULL)
+    if (config.record.compress)
+    {
+        recordCompressState = malloc(sizeof(CompressState));
+        recordFrameBuffer = malloc(COMPRESS_BOUND(COMPRESS_BLOCK_SIZE));
+        if (recordCompressState == NULL || recordFrameBuffer == NULL)
         {
-            LOG_ERROR("Failed to resolve record host");
-            return;
+            LOG_ERROR("Failed to allocate compression buffers, recording uncompressed");
+            free(recordCompressState);
+            free(recordFrameBuffer);
+            recordCompressState = NULL;
+            recordFrameBuffer = NULL;
         }
-
-        LOG_INFO("Connecting to record host: %s:%s", config.network.host, portStr);
-        for (struct addrinfo* rp = res; rp != NULL; rp = rp->ai_next)
-        {
-            recordSocket = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-            if (recordSocket < 0)
-                continue;       
-
-            if (connect(recordSocket, rp->ai_addr, rp->ai_addrlen) == 0)
-            {
-                LOG_INFO("Connected to record host: %s:%s", config.network.host, portStr);
-                break;
-            }
-
-            close(recordSocket);
-            recordSocket = -1;
-        }
-
-        if (recordSocket < 0)
-            LOG_ERROR("Failed to connect record socket");
-
-        freeaddrinfo(res);
     }
 
     if (config.record.threaded)
     {
-        LightEvent_Init(&recordThreadFlushRequestEvent, RESET_ONESHOT);
+        recordInitSegments();
+
         LightEvent_Init(&recordThreadFlushDoneEvent, RESET_ONESHOT);
-        LightEvent_Signal(&recordThreadFlushDoneEvent);
         recordThreadShouldExit = false;
+        recordThreaded = true;
 
         s32 priority = 0x30;
         svcGetThreadPriority(&priority, CUR_THREAD_HANDLE);
@@ -111,42 +239,71 @@ void recordInit()
         priority = priority < 0x18 ? 0x18 : priority;
         priority = priority > 0x3F ? 0x3F : priority;
 
-        // TODO: Use core_id 2 or 3 on New3DS?
-        const s32 coreId = 3;
+        for (u32 i = 0; i < RECORD_SINK_COUNT; i++)
+        {
+            RecordSink* sink = &recordSinks[i];
+            sink->drained = 0;
+            LightEvent_Init(&sink->flushRequestEvent, RESET_ONESHOT);
 
-        recordThread = threadCreate(recordThreadFunc, NULL, 0x2000, priority, coreId, false);
+            if ((i == RECORD_SINK_FILE && recordFile == NULL) || (i == RECORD_SINK_SOCKET && recordSocket < 0))
+                continue;
 
-        recordBase = recordBuffer;
+            sink->thread = threadCreate(recordThreadFunc, sink, 0x2000, priority, RECORD_THREAD_CORE, false);
+            if (sink->thread == NULL)
+            {
+                LOG_WARNING("Failed to create record thread for sink %lu on core %d, using the default core",
+                            i, RECORD_THREAD_CORE);
+                sink->thread = threadCreate(recordThreadFunc, sink, 0x2000, priority, -2, false);
+            }
+            if (sink->thread == NULL)
+                LOG_ERROR("Failed to create record thread for sink %lu", i);
+        }
+
+        recordBase = recordSegments[0].base;
         recordHead = recordBase;
-        recordEnd = recordBase + (RECORD_BUFFER_SIZE / 2);
+        recordEnd = recordBase + recordSegmentSize;
     }
     else 
     {
         recordBase = recordBuffer;
         recordHead = recordBase;
-        recordEnd = recordBase + RECORD_BUFFER_SIZE;
+        recordEnd = recordBase + recordBufferSize;
     }
+
+    recordSessionHeader(session);
 }
 
 void recordExit()
 {
+    // Drops since the last packet would go unnoticed otherwise
+    if (recordDroppedPackets > 0)
+    {
+        recordFlush();
+        recordDropped();
+    }
+
     recordFlush();
 
-    if (recordThread)
+    // Signal threads to exit once all segments are drained
+    recordThreadShouldExit = true;
+    for (u32 i = 0; i < RECORD_SINK_COUNT; i++)
     {
-        // Wait for last flush to complete
-        LightEvent_Wait(&recordThreadFlushDoneEvent);
+        RecordSink* sink = &recordSinks[i];
+        if (!sink->thread)
+            continue;
 
-        // Signal thread to exit
-        recordThreadShouldExit = true;
-        LightEvent_Signal(&recordThreadFlushRequestEvent);
+        LightEvent_Signal(&sink->flushRequestEvent);
+        threadJoin(sink->thread, U64_MAX);
+        threadFree(sink->thread);
 
-        // Wait for thread to exit
-        LightEvent_Wait(&recordThreadFlushDoneEvent);
-        threadJoin(recordThread, U64_MAX);
-
-        recordThread = NULL;
+        sink->thread = NULL;
     }
+    recordThreaded = false;
+
+    free(recordCompressState);
+    free(recordFrameBuffer);
+    recordCompressState = NULL;
+    recordFrameBuffer = NULL;
 
     if (recordFile)
     {
@@ -161,9 +318,9 @@ void recordExit()
     }
 }
 
-void recordFlushData(u8* data, u32 size)
+void recordWriteData(u32 sinks, const u8* data, u32 size)
 {
-    if (recordFile)
+    if ((sinks & BIT(RECORD_SINK_FILE)) && recordFile)
     {
         size_t written = 0;
         while (written < size)
@@ -182,11 +339,9 @@ void recordFlushData(u8* data, u32 size)
 
             written += chunkSize;
         }
-
-        fflush(recordFile);
     }
 
-    if (recordSocket >= 0)
+    if ((sinks & BIT(RECORD_SINK_SOCKET)) && recordSocket >= 0)
     {
         size_t sent = 0;
         while (sent < size)
@@ -211,49 +366,285 @@ void recordFlushData(u8* data, u32 size)
     LOG_TRACE("Flushed %u bytes of recorded data", size);
 }
 
+// Called once per flush instead of per write, frame headers would otherwise go to the SD card on their own
+void recordWriteEnd(u32 sinks)
+{
+    if ((sinks & BIT(RECORD_SINK_FILE)) && recordFile)
+        fflush(recordFile);
+}
+
+void recordWriteFrame(u32 sinks, const RecordFrame* frame, const u8* data)
+{
+    u8 header[RECORD_FRAME_HEADER_SIZE];
+    header[0] = 'N';
+    header[1] = 'Z';
+    memcpy(header + 2, &frame->flags, sizeof(frame->flags));
+    memcpy(header + 4, &frame->rawSize, sizeof(frame->rawSize));
+    memcpy(header + 8, &frame->size, sizeof(frame->size));
+
+    recordWriteData(sinks, header, sizeof(header));
+    recordWriteData(sinks, data, frame->size);
+}
+
+// Compresses a block into the frame buffer, a block that does not shrink is stored as it is
+RecordFrame recordCompressFrame(const u8* data, u32 rawSize)
+{
+    RecordFrame frame;
+    frame.flags = 0;
+    frame.rawSize = rawSize;
+    frame.size = compressBlock(recordCompressState, data, rawSize, recordFrameBuffer);
+    if (frame.size >= rawSize)
+    {
+        frame.flags |= RECORD_FRAME_FLAG_STORED;
+        frame.size = rawSize;
+    }
+
+    LOG_TRACE("Compressed %u bytes of recorded data to %u", rawSize, frame.size);
+    return frame;
+}
+
+void recordFlushData(const u8* data, u32 size)
+{
+    if (recordCompressState == NULL)
+    {
+        recordWriteData(RECORD_SINKS_ALL, data, size);
+        recordWriteEnd(RECORD_SINKS_ALL);
+        return;
+    }
+
+    // Frames are decoded independently, so the host can decompress a capture while it is still being received
+    while (size > 0)
+    {
+        u32 rawSize = size < COMPRESS_BLOCK_SIZE ? size : COMPRESS_BLOCK_SIZE;
+        RecordFrame frame = recordCompressFrame(data, rawSize);
+        recordWriteFrame(RECORD_SINKS_ALL, &frame, (frame.flags & RECORD_FRAME_FLAG_STORED) ? data : recordFrameBuffer);
+
+        data += rawSize;
+        size -= rawSize;
+    }
+
+    recordWriteEnd(RECORD_SINKS_ALL);
+}
+
+// Compresses the segments up to the given one in place. Whichever sink gets there first does the work,
+// the other one waits on the lock and writes the same frames.
+void recordCompressSegments(u32 index)
+{
+    if (__atomic_load_n(&recordSegmentsCompressed, __ATOMIC_ACQUIRE) > index)
+        return;
+
+    LightLock_Lock(&recordCompressLock);
+    for (u32 i = recordSegmentsCompressed; i <= index; i++)
+    {
+        RecordSegment* segment = &recordSegments[i % recordSegmentCount];
+        segment->frameCount = 0;
+
+        for (u32 offset = 0; offset < segment->size; offset += COMPRESS_BLOCK_SIZE)
+        {
+            u8* block = segment->base + offset;
+            u32 rawSize = segment->size - offset;
+            if (rawSize > COMPRESS_BLOCK_SIZE)
+                rawSize = COMPRESS_BLOCK_SIZE;
+
+            // Compressed data is always smaller than its block, so it never overwrites the next one
+            RecordFrame frame = recordCompressFrame(block, rawSize);
+            if (!(frame.flags & RECORD_FRAME_FLAG_STORED))
+                memcpy(block, recordFrameBuffer, frame.size);
+
+            segment->frames[segment->frameCount++] = frame;
+        }
+
+        __atomic_store_n(&recordSegmentsCompressed, i + 1, __ATOMIC_RELEASE);
+    }
+    LightLock_Unlock(&recordCompressLock);
+}
+
 void recordFlush()
 {
     if (recordHead == recordBase)
         return;
 
-    if (!recordThread)
+    u64 statsStart = statsBegin();
+
+    if (!recordThreaded)
     {
         recordFlushData(recordBase, recordHead - recordBase);
         recordHead = recordBase;
+        statsEnd(STATS_PHASE_FLUSH, statsStart);
         return;
     }
-    
-    // Wait for previous flush to complete
-    LOG_TRACE("Waiting for previous record flush to complete...");
-    LightEvent_Wait(&recordThreadFlushDoneEvent);
-
-    // Swap buffers
-    LOG_TRACE("Swapping record buffers and signaling...");
-    recordThreadFlushBase = recordBase;
-    recordThreadFlushSize = recordHead - recordBase;
-    recordBase = (recordBase == recordBuffer) ? (recordBuffer + (RECORD_BUFFER_SIZE / 2)) : recordBuffer;
+
+    recordPassSegment(true);
+
+    statsEnd(STATS_PHASE_FLUSH, statsStart);
+}
+
+// Segments not yet written by the sink furthest behind, a segment can only be reused once all sinks wrote it
+static u32 recordSegmentsPending(u32 filled)
+{
+    u32 pending = 0;
+    for (u32 i = 0; i < RECORD_SINK_COUNT; i++)
+    {
+        if (!recordSinks[i].thread)
+            continue;
+
+        u32 sinkPending = filled - __atomic_load_n(&recordSinks[i].drained, __ATOMIC_ACQUIRE);
+        if (sinkPending > pending)
+            pending = sinkPending;
+    }
+    return pending;
+}
+
+// Hands the current segment to the record threads and continues in the next one.
+// Without wait nothing happens unless the next segment is free already.
+bool recordPassSegment(bool wait)
+{
+    u32 filled = recordSegmentsFilled + 1;
+    if (!wait && recordSegmentsPending(filled) >= recordSegmentCount)
+        return false;
+
+    recordSegments[(filled - 1) % recordSegmentCount].size = recordHead - recordBase;
+    __atomic_store_n(&recordSegmentsFilled, filled, __ATOMIC_RELEASE);
+    for (u32 i = 0; i < RECORD_SINK_COUNT; i++)
+    {
+        if (recordSinks[i].thread)
+            LightEvent_Signal(&recordSinks[i].flushRequestEvent);
+    }
+
+    // Only blocks if a record thread fell behind by all segments
+    while (recordSegmentsPending(filled) >= recordSegmentCount)
+    {
+        LOG_TRACE("Waiting for a free record segment...");
+        LightEvent_Wait(&recordThreadFlushDoneEvent);
+    }
+
+    recordBase = recordSegments[filled % recordSegmentCount].base;
     recordHead = recordBase;
-    recordEnd = recordBase + (RECORD_BUFFER_SIZE / 2);
+    recordEnd = recordBase + recordSegmentSize;
+
+    return true;
+}
+
+void recordDropped()
+{
+    u64 tick = svcGetSystemTick();
+
+    LOG_TRACE("Dropped %lu packets (%lu samples)", recordDroppedPackets, recordDroppedSamples);
 
-    // Request new flush
-    LightEvent_Signal(&recordThreadFlushRequestEvent);
+    recordHeader(RECORD_HEADER_DROPPED);
+    recordU32((u32)tick);
+    recordU32((u32)(tick >> 32));
+    recordU32(recordDroppedSamples);
+    recordU32(recordDroppedPackets);
+
+    recordDroppedPackets = 0;
+    recordDroppedSamples = 0;
+}
+
+bool recordMakeSpace(u32 size)
+{
+    // Pending drops are recorded in front of the next packet that fits
+    u32 droppedSize = recordDroppedPackets > 0 ? sizeof(u32) * 5 : 0;
+
+    if (recordHead + droppedSize + size >= recordEnd)
+    {
+        if (config.record.onFull == CONFIG_RECORD_ON_FULL_BLOCK)
+        {
+            recordFlush();
+        }
+        else if (!recordThreaded || !recordPassSegment(false))
+        {
+            recordDroppedPackets++;
+            return false;
+        }
+    }
+
+    if (recordDroppedPackets > 0)
+        recordDropped();
+
+    return true;
+}
+
+void recordDropSamples(u32 count)
+{
+    recordDroppedSamples += count;
+}
+
+void recordFlushDeferred()
+{
+    if (config.record.onFull != CONFIG_RECORD_ON_FULL_DROP || recordThreaded)
+        return;
+
+    // Blocks the sysmodule but not the debuggee, started well before the buffer is full
+    if (recordDroppedPackets > 0 || (u32)(recordHead - recordBase) >= recordBufferSize / 2)
+        recordFlush();
+}
+
+void recordInitSegments()
+{
+    recordSegmentSize = config.record.segmentSize & ~3;
+    if (recordSegmentSize < RECORD_SEGMENT_SIZE_MIN)
+        recordSegmentSize = RECORD_SEGMENT_SIZE_MIN;
+    if (recordSegmentSize > recordBufferSize / 2)
+        recordSegmentSize = (recordBufferSize / 2) & ~3;
+
+    recordSegmentCount = config.record.segments;
+    if (recordSegmentCount > RECORD_SEGMENT_COUNT_MAX)
+        recordSegmentCount = RECORD_SEGMENT_COUNT_MAX;
+    if (recordSegmentCount > recordBufferSize / recordSegmentSize)
+        recordSegmentCount = recordBufferSize / recordSegmentSize;
+    if (recordSegmentCount < 2)
+        recordSegmentCount = 2;
+
+    for (u32 i = 0; i < recordSegmentCount; i++)
+    {
+        recordSegments[i].base = recordBuffer + i * recordSegmentSize;
+        recordSegments[i].size = 0;
+        recordSegments[i].frameCount = 0;
+    }
+
+    recordSegmentsFilled = 0;
+    recordSegmentsCompressed = 0;
+    LightLock_Init(&recordCompressLock);
+
+    LOG_INFO("Recording through %lu segments of 0x%lX bytes", recordSegmentCount, recordSegmentSize);
 }
 
 void recordThreadFunc(void* arg)
 {
+    RecordSink* sink = arg;
+    u32 sinks = BIT(sink - recordSinks);
+    u32 drained = 0;
+
     while (true)
     {
-		LightEvent_Wait(&recordThreadFlushRequestEvent);
-        LOG_TRACE("Record thread: Woke up for flush request");
-		if (recordThreadShouldExit)
+        if (drained == __atomic_load_n(&recordSegmentsFilled, __ATOMIC_ACQUIRE))
         {
-            LightEvent_Signal(&recordThreadFlushDoneEvent);
-            break;
+            if (recordThreadShouldExit)
+                break;
+
+            LightEvent_Wait(&sink->flushRequestEvent);
+            LOG_TRACE("Record thread: Woke up for flush request");
+            continue;
         }
 
-        LOG_TRACE("Record thread: Flushing %u bytes", recordThreadFlushSize);
-        recordFlushData(recordThreadFlushBase, recordThreadFlushSize);
+        // A sink that failed is closed by its own thread, which keeps draining so the ring does not stall
+        RecordSegment* segment = &recordSegments[drained % recordSegmentCount];
+        LOG_TRACE("Record thread: Flushing %u bytes", segment->size);
+        if (recordCompressState)
+        {
+            recordCompressSegments(drained);
+            for (u32 i = 0; i < segment->frameCount; i++)
+                recordWriteFrame(sinks, &segment->frames[i], segment->base + i * COMPRESS_BLOCK_SIZE);
+        }
+        else
+        {
+            recordWriteData(sinks, segment->base, segment->size);
+        }
+        recordWriteEnd(sinks);
         LOG_TRACE("Record thread: Flush complete");
+
+        __atomic_store_n(&sink->drained, ++drained, __ATOMIC_RELEASE);
         LightEvent_Signal(&recordThreadFlushDoneEvent);
-	}
+    }
 }
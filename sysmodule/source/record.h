@@ -11,21 +11,69 @@
 
 typedef enum {
     RECORD_HEADER_SAMPLE = MAKE_RECORD_HEADER(1),
+    RECORD_HEADER_SAMPLE_CHAIN = MAKE_RECORD_HEADER(2),
+    RECORD_HEADER_AGGREGATE = MAKE_RECORD_HEADER(3),
+    RECORD_HEADER_INTERVAL = MAKE_RECORD_HEADER(4),
+    RECORD_HEADER_EVENT = MAKE_RECORD_HEADER(5),
+    RECORD_HEADER_COUNTERS = MAKE_RECORD_HEADER(6),
+    RECORD_HEADER_SCHEDULE_IN = MAKE_RECORD_HEADER(7),
+    RECORD_HEADER_SCHEDULE_OUT = MAKE_RECORD_HEADER(8),
+    RECORD_HEADER_SESSION = MAKE_RECORD_HEADER(9),
+    RECORD_HEADER_BREAK = MAKE_RECORD_HEADER(10),
+    RECORD_HEADER_FRAME = MAKE_RECORD_HEADER(11),
+    RECORD_HEADER_SYSCALL_IN = MAKE_RECORD_HEADER(12),
+    RECORD_HEADER_SYSCALL_OUT = MAKE_RECORD_HEADER(13),
+    RECORD_HEADER_SERVICE = MAKE_RECORD_HEADER(14),
+    RECORD_HEADER_IPC_REQUEST = MAKE_RECORD_HEADER(15),
+    RECORD_HEADER_IPC_REPLY = MAKE_RECORD_HEADER(16),
+    RECORD_HEADER_MODULE = MAKE_RECORD_HEADER(17),
+    RECORD_HEADER_STATS = MAKE_RECORD_HEADER(18),
+    RECORD_HEADER_DROPPED = MAKE_RECORD_HEADER(19),
+    RECORD_HEADER_SAMPLE_DELTA = MAKE_RECORD_HEADER(20),
+    RECORD_HEADER_CHAIN_DEFINE = MAKE_RECORD_HEADER(21),
+    RECORD_HEADER_SAMPLE_REF = MAKE_RECORD_HEADER(22),
+    RECORD_HEADER_SAMPLE_PC = MAKE_RECORD_HEADER(23),   // Thread slot in the last header byte
+    RECORD_HEADER_THREAD_SLOT = MAKE_RECORD_HEADER(24),
 } RecordHeader;
 
 #undef MAKE_RECORD_HEADER
 
+// Increased whenever the layout of existing packets changes
+#define RECORD_FORMAT_VERSION 3
+
+typedef struct {
+    u64 programId;
+    char processName[8];
+    u64 startTick;
+    u32 sampleInterval;
+} RecordSession;
+
 extern u8* recordHead;
 extern u8* recordEnd;
 
-void recordInit();
+// Packets dropped with OnFull=Drop since the last dropped record
+extern u32 recordDroppedPackets;
+
+// Part of the record buffer handed out to other users, e.g. the aggregation table
+extern u8* recordArena;
+extern u32 recordArenaSize;
+
+void recordInit(const RecordSession* session);
 void recordExit();
 void recordFlush();
 
-inline void recordEnsureSpace(u32 size)
+// Writes out data held back with OnFull=Drop, called while the debuggee is running
+void recordFlushDeferred();
+
+bool recordMakeSpace(u32 size);
+void recordDropSamples(u32 count);
+
+// Returns false if the packet has to be dropped, only happens with OnFull=Drop
+inline bool recordEnsureSpace(u32 size)
 {
-    if (recordHead + size >= recordEnd)
-        recordFlush();
+    if (recordHead + size < recordEnd && recordDroppedPackets == 0)
+        return true;
+    return recordMakeSpace(size);
 }
 
 inline void recordData(const void* data, u32 size)
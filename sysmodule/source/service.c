@@ -0,0 +1,97 @@
+#include "service.h"
+#include "csvc.h"
+#include "record.h"
+#include "log.h"
+
+#include <string.h>
+
+#define SERVICE_MAX_HANDLES 0x40
+
+typedef struct
+{
+    Handle handle;
+    bool named;
+} ServiceHandle;
+
+static Handle serviceProcess = 0;
+static ServiceHandle serviceHandles[SERVICE_MAX_HANDLES];
+static size_t serviceHandleCount = 0;
+
+void serviceInit(Handle process)
+{
+    serviceExit();
+
+    serviceProcess = process;
+}
+
+void serviceExit()
+{
+    serviceProcess = 0;
+    serviceHandleCount = 0;
+}
+
+static void serviceRecordName(Handle handle, const char* name)
+{
+    if (!recordEnsureSpace(sizeof(u32) * 2 + SERVICE_NAME_LENGTH))
+        return;
+    recordHeader(RECORD_HEADER_SERVICE);
+    recordU32(handle);
+    recordData(name, SERVICE_NAME_LENGTH);
+}
+
+bool serviceResolve(Handle handle)
+{
+    Result r;
+    Handle copy;
+    char name[SERVICE_NAME_LENGTH];
+
+    for (size_t i = 0; i < serviceHandleCount; i++)
+    {
+        if (serviceHandles[i].handle == handle)
+            return serviceHandles[i].named;
+    }
+
+    if (serviceProcess == 0)
+        return false;
+
+    // The name can only be looked up through a handle of our own
+    memset(name, 0, sizeof(name));
+    r = svcCopyHandle(&copy, CUR_PROCESS_HANDLE, handle, serviceProcess);
+    if (R_SUCCEEDED(r))
+    {
+        r = svcControlService(SERVICEOP_GET_NAME, name, copy);
+        svcCloseHandle(copy);
+    }
+
+    bool named = R_SUCCEEDED(r);
+    if (named)
+        serviceRecordName(handle, name);
+    else
+        LOG_TRACE("Resolving service of handle 0x%08X failed: %08X", handle, r);
+
+    // Oldest entry is replaced when full, it is resolved and recorded again if used later
+    if (serviceHandleCount >= SERVICE_MAX_HANDLES)
+    {
+        memmove(&serviceHandles[0], &serviceHandles[1], sizeof(serviceHandles[0]) * (SERVICE_MAX_HANDLES - 1));
+        serviceHandleCount--;
+    }
+    serviceHandles[serviceHandleCount++] = (ServiceHandle){
+        .handle = handle,
+        .named = named,
+    };
+
+    return named;
+}
+
+void serviceForget(Handle handle)
+{
+    for (size_t i = 0; i < serviceHandleCount; i++)
+    {
+        if (serviceHandles[i].handle == handle)
+        {
+            memmove(&serviceHandles[i], &serviceHandles[i + 1], sizeof(serviceHandles[0]) * (serviceHandleCount - i - 1));
+            serviceHandleCount--;
+            return;
+        }
+    }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <3ds.h>
+
+
+#define SERVICE_NAME_LENGTH 12
+
+void serviceInit(Handle process);
+void serviceExit();
+
+// Resolves the service behind a session handle of the debuggee, recording its name the first time
+bool serviceResolve(Handle handle);
+
+// Drops a closed handle, its value may be reused for another service
+void serviceForget(Handle handle);
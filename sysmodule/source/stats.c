@@ -0,0 +1,99 @@
+#include "stats.h"
+#include "record.h"
+#include "config.h"
+
+#include <string.h>
+
+typedef struct
+{
+    u32 count;
+    u32 min;
+    u32 max;
+    u64 total;
+} StatsPhaseTicks;
+
+bool statsEnabled = false;
+
+static StatsPhaseTicks statsPhases[STATS_PHASE_COUNT];
+static u32 statsSamples = 0;
+static u64 statsStartTick = 0;
+
+static void statsClear(u64 now)
+{
+    memset(statsPhases, 0, sizeof(statsPhases));
+    statsSamples = 0;
+    statsStartTick = now;
+}
+
+static void statsRecord(u64 now)
+{
+    StatsPhaseTicks phases[STATS_PHASE_COUNT];
+    u32 samples = statsSamples;
+    u64 elapsed = now - statsStartTick;
+
+    // Writing may flush, which already counts towards the next interval
+    memcpy(phases, statsPhases, sizeof(phases));
+    statsClear(now);
+
+    if (!recordEnsureSpace(sizeof(u32) * (7 + STATS_PHASE_COUNT * 5)))
+        return;
+    recordHeader(RECORD_HEADER_STATS);
+    recordU32((u32)now);
+    recordU32((u32)(now >> 32));
+    recordU32((u32)elapsed);
+    recordU32((u32)(elapsed >> 32));
+    recordU32(samples);
+    // Readers skip phases they do not know
+    recordU32(STATS_PHASE_COUNT);
+    for (u32 i = 0; i < STATS_PHASE_COUNT; i++)
+    {
+        recordU32(phases[i].count);
+        recordU32(phases[i].min);
+        recordU32(phases[i].max);
+        recordU32((u32)phases[i].total);
+        recordU32((u32)(phases[i].total >> 32));
+    }
+}
+
+void statsInit()
+{
+    statsEnabled = config.record.statsInterval > 0;
+    statsClear(svcGetSystemTick());
+}
+
+void statsExit()
+{
+    // Last partial interval
+    if (statsEnabled)
+        statsRecord(svcGetSystemTick());
+
+    statsEnabled = false;
+}
+
+void statsAdd(StatsPhase phase, u64 ticks)
+{
+    StatsPhaseTicks* stats = &statsPhases[phase];
+    u32 value = ticks > UINT32_MAX ? UINT32_MAX : (u32)ticks;
+
+    if (stats->count == 0 || value < stats->min)
+        stats->min = value;
+    if (value > stats->max)
+        stats->max = value;
+    stats->count++;
+    stats->total += ticks;
+}
+
+void statsCountSample()
+{
+    statsSamples++;
+}
+
+void statsUpdate()
+{
+    if (!statsEnabled)
+        return;
+
+    u64 now = svcGetSystemTick();
+    if (now - statsStartTick >= (u64)config.record.statsInterval * (SYSCLOCK_ARM11 / 1000))
+        statsRecord(now);
+}
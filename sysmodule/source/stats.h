@@ -0,0 +1,39 @@
+#pragma once
+
+#include <3ds.h>
+
+
+// Phases of the profiler's own work, measured in system ticks
+typedef enum {
+    STATS_PHASE_WAIT,       // Waiting for the next event while attached
+    STATS_PHASE_BREAK,      // From the counter overflow until the debuggee is stopped
+    STATS_PHASE_CONTEXT,    // Fetching a thread context
+    STATS_PHASE_STACK,      // Reading or unwinding a thread stack
+    STATS_PHASE_RECORD,     // Writing a sample, including flushes it triggers
+    STATS_PHASE_FLUSH,      // Flushing the record buffer or waiting for the record thread
+    STATS_PHASE_SAMPLE,     // Whole break from the counter overflow until resume
+    STATS_PHASE_COUNT,
+} StatsPhase;
+
+extern bool statsEnabled;
+
+void statsInit();
+void statsExit();
+
+void statsAdd(StatsPhase phase, u64 ticks);
+void statsCountSample();
+
+// Records the statistics once the configured interval has passed
+void statsUpdate();
+
+// Start tick of a measured phase, 0 if statistics are disabled
+static inline u64 statsBegin()
+{
+    return statsEnabled ? svcGetSystemTick() : 0;
+}
+
+static inline void statsEnd(StatsPhase phase, u64 start)
+{
+    if (start != 0)
+        statsAdd(phase, svcGetSystemTick() - start);
+}
@@ -0,0 +1,493 @@
+#include "unwind.h"
+#include "code.h"
+#include "csvc.h"
+#include "log.h"
+
+#include <string.h>
+
+// Read-only code segments are mapped into this window while searching for the exception index table
+#define UNWIND_MAP_BASE     0x0E000000
+#define UNWIND_MAP_SIZE     0x01000000
+
+#define UNWIND_QUERY_START  0x00100000
+#define UNWIND_QUERY_END    0x40000000
+
+// Shortest run of plausible entries accepted as .ARM.exidx
+#define UNWIND_MIN_ENTRIES  0x10
+
+#define EXIDX_CANTUNWIND    0x00000001
+
+typedef struct
+{
+    u32 function;
+    u32 data;
+} ExidxEntry;
+
+static Handle unwindDebug = 0;
+static Handle unwindProcess = 0;
+
+static u32 unwindMapSrc = 0;
+static u32 unwindMapSize = 0;
+
+// The table is sorted by function address, so it is searched in place through the mapping
+static const ExidxEntry* exidx = NULL;
+static u32 exidxAddr = 0;
+static u32 exidxCount = 0;
+
+// Code range covered by the table, pcs of other modules must not resolve to its first or last entry
+static u32 exidxTextStart = 0;
+static u32 exidxTextEnd = 0;
+
+static inline u32 prel31(u32 addr, u32 value)
+{
+    return addr + ((s32)(value << 1) >> 1);
+}
+
+static bool unwindReadCode(u32 addr, u32* out)
+{
+    if (addr >= unwindMapSrc && addr + sizeof(u32) <= unwindMapSrc + unwindMapSize)
+    {
+        *out = *(const u32*)(UNWIND_MAP_BASE + (addr - unwindMapSrc));
+        return true;
+    }
+
+    return R_SUCCEEDED(svcReadProcessMemory(out, unwindDebug, addr, sizeof(u32)));
+}
+
+static bool isPlausibleEntry(u32 addr, const ExidxEntry* entry, u32 regionStart, u32 regionEnd)
+{
+    if (entry->function & 0x80000000)
+        return false;
+    if (!codeIsExecutable(prel31(addr, entry->function)))
+        return false;
+
+    if (entry->data == EXIDX_CANTUNWIND)
+        return true;
+
+    // Inline compact model, only personality 0 is allowed
+    if (entry->data & 0x80000000)
+        return (entry->data & 0x7F000000) == 0;
+
+    u32 extab = prel31(addr + 4, entry->data);
+    return extab >= regionStart && extab < regionEnd;
+}
+
+// Finds the longest run of sorted, plausible exidx entries in the mapped region
+static void findExidx(u32 regionStart, u32 regionSize)
+{
+    const u32* words = (const u32*)UNWIND_MAP_BASE;
+    u32 wordCount = regionSize / sizeof(u32);
+
+    for (u32 parity = 0; parity < 2; parity++)
+    {
+        u32 runStart = 0;
+        u32 runCount = 0;
+        u32 lastFunction = 0;
+
+        for (u32 i = parity; i + 1 < wordCount; i += 2)
+        {
+            u32 addr = regionStart + i * sizeof(u32);
+            const ExidxEntry* entry = (const ExidxEntry*)&words[i];
+
+            bool valid = isPlausibleEntry(addr, entry, regionStart, regionStart + regionSize);
+            u32 function = prel31(addr, entry->function);
+
+            if (valid && runCount > 0 && function >= lastFunction)
+            {
+                runCount++;
+            }
+            else
+            {
+                if (runCount > exidxCount)
+                {
+                    exidxAddr = regionStart + runStart * sizeof(u32);
+                    exidxCount = runCount;
+                }
+                runStart = i;
+                runCount = valid ? 1 : 0;
+            }
+
+            lastFunction = function;
+        }
+
+        if (runCount > exidxCount)
+        {
+            exidxAddr = regionStart + runStart * sizeof(u32);
+            exidxCount = runCount;
+        }
+    }
+}
+
+bool unwindInit(Handle debug, Handle process)
+{
+    Result r;
+    MemInfo memInfo;
+    PageInfo pageInfo;
+
+    unwindExit();
+
+    unwindDebug = debug;
+    unwindProcess = process;
+
+    if (process == 0)
+        return false;
+
+    u32 addr = UNWIND_QUERY_START;
+    while (addr < UNWIND_QUERY_END)
+    {
+        r = svcQueryDebugProcessMemory(&memInfo, &pageInfo, debug, addr);
+        if (R_FAILED(r) || memInfo.size == 0)
+            break;
+
+        addr = memInfo.base_addr + memInfo.size;
+
+        if (memInfo.state != MEMSTATE_CODE || memInfo.perm != MEMPERM_READ)
+            continue;
+
+        u32 size = memInfo.size > UNWIND_MAP_SIZE ? UNWIND_MAP_SIZE : memInfo.size;
+
+        r = svcMapProcessMemoryEx(process, UNWIND_MAP_BASE, memInfo.base_addr, size);
+        if (R_FAILED(r))
+        {
+            LOG_WARNING("Mapping read-only code 0x%08X-0x%08X failed: %08X", memInfo.base_addr, memInfo.base_addr + size, r);
+            continue;
+        }
+
+        u32 previousCount = exidxCount;
+        findExidx(memInfo.base_addr, size);
+
+        // The first region holding a usable table is kept mapped and used, its extab is usually right next to it
+        if (exidxCount > previousCount && exidxCount >= UNWIND_MIN_ENTRIES)
+        {
+            if (unwindMapSize > 0)
+                svcUnmapProcessMemoryEx(process, UNWIND_MAP_BASE, unwindMapSize);
+            unwindMapSrc = memInfo.base_addr;
+            unwindMapSize = size;
+            break;
+        }
+
+        svcUnmapProcessMemoryEx(process, UNWIND_MAP_BASE, size);
+    }
+
+    if (exidxCount < UNWIND_MIN_ENTRIES || unwindMapSize == 0)
+    {
+        LOG_WARNING("No unwind info found, falling back to raw stacks");
+        unwindExit();
+        return false;
+    }
+
+    exidx = (const ExidxEntry*)(UNWIND_MAP_BASE + (exidxAddr - unwindMapSrc));
+
+    // All entries were checked to point into executable code, the last one's range ends the covered text
+    exidxTextStart = prel31(exidxAddr, exidx[0].function);
+    u32 lastAddr = exidxAddr + (exidxCount - 1) * sizeof(ExidxEntry);
+    const CodeRange* lastRange = codeGetRange(prel31(lastAddr, exidx[exidxCount - 1].function));
+    exidxTextEnd = lastRange ? lastRange->end : prel31(lastAddr, exidx[exidxCount - 1].function);
+
+    LOG_INFO("Unwind info found at 0x%08X (%lu entries)", exidxAddr, exidxCount);
+
+    return true;
+}
+
+void unwindExit()
+{
+    if (unwindMapSize > 0)
+        svcUnmapProcessMemoryEx(unwindProcess, UNWIND_MAP_BASE, unwindMapSize);
+
+    unwindMapSrc = 0;
+    unwindMapSize = 0;
+    exidx = NULL;
+    exidxAddr = 0;
+    exidxCount = 0;
+    exidxTextStart = 0;
+    exidxTextEnd = 0;
+    unwindDebug = 0;
+    unwindProcess = 0;
+}
+
+bool unwindAvailable()
+{
+    return exidx != NULL;
+}
+
+static const ExidxEntry* findEntry(u32 pc, u32* entryAddr)
+{
+    u32 lo = 0;
+    u32 hi = exidxCount;
+
+    if (pc < exidxTextStart || pc >= exidxTextEnd)
+        return NULL;
+
+    // Last entry with function <= pc
+    while (lo < hi)
+    {
+        u32 mid = lo + (hi - lo) / 2;
+        u32 function = prel31(exidxAddr + mid * sizeof(ExidxEntry), exidx[mid].function);
+        if (function <= pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo == 0)
+        return NULL;
+
+    // The table usually ends with a cantunwind sentinel at the end of the text, nothing past it is covered
+    if (lo == exidxCount && exidx[lo - 1].data == EXIDX_CANTUNWIND)
+        return NULL;
+
+    *entryAddr = exidxAddr + (lo - 1) * sizeof(ExidxEntry);
+    return &exidx[lo - 1];
+}
+
+#define UNWIND_MAX_INSTR_WORDS 8
+
+typedef struct
+{
+    u32 words[UNWIND_MAX_INSTR_WORDS];
+    u32 wordCount;
+    u32 pos;    // in bytes, most significant byte of each word first
+} UnwindInstructions;
+
+static inline bool nextInstruction(UnwindInstructions* instr, u8* out)
+{
+    if (instr->pos >= instr->wordCount * 4)
+        return false;
+    u32 word = instr->words[instr->pos / 4];
+    *out = word >> (24 - (instr->pos % 4) * 8);
+    instr->pos++;
+    return true;
+}
+
+static bool getInstructions(u32 entryAddr, const ExidxEntry* entry, UnwindInstructions* instr)
+{
+    u32 word;
+    u32 extra = 0;
+    u32 extab;
+
+    memset(instr, 0, sizeof(*instr));
+
+    if (entry->data == EXIDX_CANTUNWIND)
+        return false;
+
+    if (entry->data & 0x80000000)
+    {
+        // Inline personality 0, three instruction bytes
+        instr->words[0] = entry->data;
+        instr->wordCount = 1;
+        instr->pos = 1;
+        return true;
+    }
+
+    extab = prel31(entryAddr + 4, entry->data);
+    if (!unwindReadCode(extab, &word))
+        return false;
+
+    if (word & 0x80000000)
+    {
+        u32 personality = (word >> 24) & 0xF;
+        if (personality == 0)
+        {
+            instr->pos = 1;
+        }
+        else if (personality == 1 || personality == 2)
+        {
+            extra = (word >> 16) & 0xFF;
+            instr->pos = 2;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    else
+    {
+        // Generic model, the personality routine is followed by compact instructions
+        extab += 4;
+        if (!unwindReadCode(extab, &word))
+            return false;
+        extra = word >> 24;
+        instr->pos = 1;
+    }
+
+    if (extra + 1 > UNWIND_MAX_INSTR_WORDS)
+        return false;
+
+    instr->words[0] = word;
+    for (u32 i = 0; i < extra; i++)
+    {
+        if (!unwindReadCode(extab + 4 + i * 4, &instr->words[1 + i]))
+            return false;
+    }
+    instr->wordCount = 1 + extra;
+
+    return true;
+}
+
+static bool popRegisters(u32* regs, u32* vsp, u32 mask, UnwindReadFunc read, void* arg)
+{
+    // vsp is only updated once all pops are done, as sp itself may be in the mask
+    u32 addr = *vsp;
+    bool spPopped = false;
+    u32 newSp = 0;
+
+    for (u32 i = 0; i < 16; i++)
+    {
+        if (!(mask & BIT(i)))
+            continue;
+        u32 value;
+        if (!read(addr, &value, arg))
+            return false;
+        if (i == 13)
+        {
+            spPopped = true;
+            newSp = value;
+        }
+        else
+        {
+            regs[i] = value;
+        }
+        addr += 4;
+    }
+
+    *vsp = spPopped ? newSp : addr;
+    return true;
+}
+
+// Executes the unwind instructions of a frame, returns false if unwinding has to stop
+static bool executeInstructions(u32* regs, UnwindInstructions* instr, UnwindReadFunc read, void* arg)
+{
+    u32 vsp = regs[13];
+    bool pcSet = false;
+    u8 op;
+    u8 op2;
+
+    while (nextInstruction(instr, &op))
+    {
+        if ((op & 0xC0) == 0x00)
+        {
+            vsp += ((op & 0x3F) << 2) + 4;
+        }
+        else if ((op & 0xC0) == 0x40)
+        {
+            vsp -= ((op & 0x3F) << 2) + 4;
+        }
+        else if ((op & 0xF0) == 0x80)
+        {
+            if (!nextInstruction(instr, &op2))
+                return false;
+            u32 mask = ((op & 0x0F) << 12) | (op2 << 4);
+            if (mask == 0)
+                return false;   // Refuse to unwind
+            if (!popRegisters(regs, &vsp, mask, read, arg))
+                return false;
+            if (mask & BIT(15))
+                pcSet = true;
+        }
+        else if ((op & 0xF0) == 0x90)
+        {
+            u32 reg = op & 0x0F;
+            if (reg == 13 || reg == 15)
+                return false;
+            vsp = regs[reg];
+        }
+        else if ((op & 0xF0) == 0xA0)
+        {
+            u32 mask = (BIT((op & 0x07) + 5) - 1) & ~0xF;
+            if (op & 0x08)
+                mask |= BIT(14);
+            if (!popRegisters(regs, &vsp, mask, read, arg))
+                return false;
+        }
+        else if (op == 0xB0)
+        {
+            break;
+        }
+        else if (op == 0xB1)
+        {
+            if (!nextInstruction(instr, &op2) || op2 == 0 || (op2 & 0xF0))
+                return false;
+            if (!popRegisters(regs, &vsp, op2, read, arg))
+                return false;
+        }
+        else if (op == 0xB2)
+        {
+            u32 value = 0;
+            u32 shift = 0;
+            do
+            {
+                if (!nextInstruction(instr, &op2))
+                    return false;
+                value |= (op2 & 0x7F) << shift;
+                shift += 7;
+            } while ((op2 & 0x80) && shift < 32);
+            vsp += 0x204 + (value << 2);
+        }
+        else if (op == 0xB3 || op == 0xC8 || op == 0xC9)
+        {
+            // VFP registers are not tracked, only skipped
+            if (!nextInstruction(instr, &op2))
+                return false;
+            vsp += ((op2 & 0x0F) + 1) * 8 + (op == 0xB3 ? 4 : 0);
+        }
+        else if ((op & 0xF8) == 0xB8)
+        {
+            vsp += ((op & 0x07) + 1) * 8 + 4;
+        }
+        else if ((op & 0xF8) == 0xD0)
+        {
+            vsp += ((op & 0x07) + 1) * 8;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    if (!pcSet)
+        regs[15] = regs[14];
+    regs[13] = vsp;
+
+    return true;
+}
+
+s32 unwindChain(const CpuRegisters* cpuRegs, u32* chain, u32 maxDepth, UnwindReadFunc read, void* arg)
+{
+    u32 regs[16];
+    u32 entryAddr;
+    UnwindInstructions instr;
+    u32 depth = 0;
+
+    if (exidx == NULL)
+        return -1;
+
+    memcpy(regs, cpuRegs->r, sizeof(cpuRegs->r));
+    regs[13] = cpuRegs->sp;
+    regs[14] = cpuRegs->lr;
+    regs[15] = cpuRegs->pc;
+
+    while (depth < maxDepth)
+    {
+        u32 pc = regs[15] & ~1;
+        u32 sp = regs[13];
+
+        // Past the first frame pc is a return address, the call before it may be the last instruction of its function
+        const ExidxEntry* entry = findEntry(depth == 0 ? pc : pc - 1, &entryAddr);
+        if (entry == NULL)
+            return depth == 0 ? -1 : (s32)depth;
+
+        if (!getInstructions(entryAddr, entry, &instr))
+            break;
+        if (!executeInstructions(regs, &instr, read, arg))
+            break;
+
+        if (regs[15] == 0 || !codeIsExecutable(regs[15]))
+            break;
+        if ((regs[15] & ~1) == pc && regs[13] == sp)
+            break;
+
+        chain[depth++] = regs[15];
+    }
+
+    return depth;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <3ds.h>
+
+
+#define UNWIND_MAX_DEPTH 0x40
+
+// Reads a word of the unwound thread's stack
+typedef bool (*UnwindReadFunc)(u32 addr, u32* out, void* arg);
+
+bool unwindInit(Handle debug, Handle process);
+void unwindExit();
+bool unwindAvailable();
+
+// Fills chain with the return addresses of the frames above the one described by regs.
+// Returns the number of return addresses or -1 if there is no unwind info for the pc.
+s32 unwindChain(const CpuRegisters* regs, u32* chain, u32 maxDepth, UnwindReadFunc read, void* arg);
@@ -9,6 +9,7 @@ def main() -> int:
     parser = argparse.ArgumentParser(description='NextProf Viewer')
     parser.add_argument('-f', '--file', type=str, help='Path to the profile file to load')
     parser.add_argument('-s', '--symbols', type=str, nargs='*', help='Paths to symbol files to load')
+    parser.add_argument('-m', '--module-symbols', type=str, nargs='*', help='Paths to symbol files of dynamically loaded modules in the format path:module_name, relocated to where the module is mapped')
     parser.add_argument('-c', '--code', type=str, nargs='*', help='Paths to code files to load with their base addresses in the format path:address (hex, default 0x100000)')
     args = parser.parse_args()
     
@@ -27,10 +28,18 @@ def main() -> int:
             addr = 0x100000
         initial_code_paths.append((path, addr))
 
+    initial_module_symbol_paths = []
+    for module_arg in args.module_symbols or []:
+        path, _, module_name = module_arg.rpartition(':')
+        if not path:
+            parser.error(f'Module symbols must be given as path:module_name: {module_arg}')
+        initial_module_symbol_paths.append((path, module_name))
+
     window = MainWindow(
         initial_file_path=args.file,
         initial_symbol_paths=args.symbols,
         initial_code_paths=initial_code_paths,
+        initial_module_symbol_paths=initial_module_symbol_paths,
     )
     window.show()
     return app.exec()
@@ -0,0 +1,41 @@
+from PyQt6.QtWidgets import (QWidget, QVBoxLayout, QTableWidget, QTableWidgetItem, QAbstractItemView)
+
+from .profile import Profile, BLOCKING_SYSCALLS
+from .timeline_widget import NumberItem
+
+
+class BlockingWidget(QWidget):
+    """Time spent blocked in syscalls per calling function, from recorded syscall events."""
+
+    def __init__(self):
+        super().__init__()
+        self.setup_ui()
+
+    def setup_ui(self):
+        layout = QVBoxLayout(self)
+        layout.setContentsMargins(0, 0, 0, 0)
+
+        self.table = QTableWidget(self)
+        self.table.setColumnCount(6)
+        self.table.setHorizontalHeaderLabels(['Address', 'Caller', 'Syscall', 'Calls', 'Total ms', 'Max ms'])
+        self.table.setSelectionBehavior(QAbstractItemView.SelectionBehavior.SelectRows)
+        self.table.setEditTriggers(QAbstractItemView.EditTrigger.NoEditTriggers)
+        self.table.setSortingEnabled(True)
+        self.table.verticalHeader().setVisible(False)
+        layout.addWidget(self.table)
+
+    def set_profile(self, profile: Profile):
+        stats = sorted(profile.blocking.values(), key=lambda s: s.ticks, reverse=True)
+
+        self.table.setSortingEnabled(False)
+        self.table.setRowCount(len(stats))
+        for row, stat in enumerate(stats):
+            self.table.setItem(row, 0, NumberItem(stat.caller_addr, f'0x{stat.caller_addr:08X}'))
+            self.table.setItem(row, 1, QTableWidgetItem(stat.caller_name))
+            self.table.setItem(row, 2, QTableWidgetItem(BLOCKING_SYSCALLS.get(stat.syscall, f'0x{stat.syscall:02X}')))
+            self.table.setItem(row, 3, NumberItem(stat.count, f'{stat.count}'))
+            total_ms = profile.ticks_to_ms(stat.ticks)
+            self.table.setItem(row, 4, NumberItem(total_ms, f'{total_ms:.2f}'))
+            max_ms = profile.ticks_to_ms(stat.max_ticks)
+            self.table.setItem(row, 5, NumberItem(max_ms, f'{max_ms:.2f}'))
+        self.table.setSortingEnabled(True)
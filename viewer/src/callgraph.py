@@ -76,9 +76,9 @@ def generate_callgraph(
         if len(func_name) > 50:
             func_name = func_name[:47] + '...'
         
-        label = f'{func_name}\\n{percentage:.1f}% ({func.hit_count})'
+        label = f'{func_name}\\n{percentage:.1f}% ({func.hit_count:.0f})'
         if func.hit_count_direct > 0:
-            label += f'\\n{direct_percentage:.1f}% direct ({func.hit_count_direct})'
+            label += f'\\n{direct_percentage:.1f}% direct ({func.hit_count_direct:.0f})'
         
         dot.node(
             f'func_{func.address:x}',
@@ -0,0 +1,81 @@
+# Captures recorded with Compress=Yes consist of frames, each holding LZ4 compressed packets
+FRAME_MAGIC = b'NZ'
+FRAME_HEADER_SIZE = 12
+FRAME_FLAG_STORED = 1
+
+
+def decompress_block(data: memoryview, raw_size: int) -> bytearray:
+    """Decodes an LZ4 block."""
+    out = bytearray()
+    pos = 0
+    while pos < len(data):
+        token = data[pos]
+        pos += 1
+
+        literal_count = token >> 4
+        if literal_count == 0xF:
+            while True:
+                value = data[pos]
+                pos += 1
+                literal_count += value
+                if value != 0xFF:
+                    break
+        out += data[pos:pos + literal_count]
+        pos += literal_count
+
+        # Last sequence of a block has no match
+        if pos >= len(data):
+            break
+
+        offset = data[pos] | (data[pos + 1] << 8)
+        pos += 2
+        match_length = token & 0xF
+        if match_length == 0xF:
+            while True:
+                value = data[pos]
+                pos += 1
+                match_length += value
+                if value != 0xFF:
+                    break
+        match_length += 4
+
+        start = len(out) - offset
+        if offset >= match_length:
+            out += out[start:start + match_length]
+        else:
+            # Overlapping match repeats the last offset bytes
+            pattern = out[start:]
+            out += (pattern * (match_length // offset + 1))[:match_length]
+
+    if len(out) != raw_size:
+        raise ValueError(f'Corrupt compressed frame, expected {raw_size} bytes, got {len(out)}')
+    return out
+
+
+def is_compressed(data: bytes) -> bool:
+    return data[:2] == FRAME_MAGIC
+
+
+def decompress_frames(data: bytes) -> tuple[bytes, int]:
+    """Decodes all complete frames, returns the packet data and the number of bytes consumed."""
+    view = memoryview(data)
+    out = bytearray()
+    pos = 0
+    while pos + FRAME_HEADER_SIZE <= len(data):
+        if view[pos:pos + 2] != FRAME_MAGIC:
+            raise ValueError('Invalid compressed frame magic')
+        flags = int.from_bytes(view[pos + 2:pos + 4], 'little')
+        raw_size = int.from_bytes(view[pos + 4:pos + 8], 'little')
+        size = int.from_bytes(view[pos + 8:pos + 12], 'little')
+
+        # Frames still being written are left for the next load
+        if pos + FRAME_HEADER_SIZE + size > len(data):
+            break
+
+        payload = view[pos + FRAME_HEADER_SIZE:pos + FRAME_HEADER_SIZE + size]
+        if flags & FRAME_FLAG_STORED:
+            out += payload
+        else:
+            out += decompress_block(payload, raw_size)
+        pos += FRAME_HEADER_SIZE + size
+    return bytes(out), pos
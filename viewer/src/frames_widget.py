@@ -0,0 +1,103 @@
+from PyQt6.QtWidgets import (QWidget, QVBoxLayout, QHBoxLayout, QLabel, QDoubleSpinBox, QGraphicsScene)
+from PyQt6.QtCore import Qt, pyqtSignal
+from PyQt6.QtGui import QBrush, QColor, QPen
+
+import math
+
+from .profile import Profile
+from .callgraph_widget import CallGraphView
+
+
+BAR_WIDTH = 12
+BAR_SPACING = 2
+HISTOGRAM_HEIGHT = 300
+MAX_BINS = 100
+
+
+def draw_histogram(scene: QGraphicsScene, values: list[float], highlight_from: float = 0, unit: str = 'ms'):
+    """Draws a histogram of values into scene, bins from highlight_from on are highlighted."""
+    max_value = max(values)
+    bin_size = max(1, math.ceil(max_value / MAX_BINS))
+    bins = [0] * (int(max_value // bin_size) + 1)
+    for value in values:
+        bins[int(value // bin_size)] += 1
+
+    # Counts are drawn on a log scale, the interesting slow cases are rare
+    max_height = math.log1p(max(bins))
+    no_pen = QPen(Qt.PenStyle.NoPen)
+
+    for i, count in enumerate(bins):
+        x = i * (BAR_WIDTH + BAR_SPACING)
+        if count > 0:
+            height = math.log1p(count) / max_height * HISTOGRAM_HEIGHT
+            highlight = highlight_from > 0 and (i + 1) * bin_size > highlight_from
+            color = QColor('#e74c3c' if highlight else '#3498db')
+            bar = scene.addRect(x, HISTOGRAM_HEIGHT - height, BAR_WIDTH, height, no_pen, QBrush(color))
+            bar.setToolTip(f'{i * bin_size}-{(i + 1) * bin_size} {unit}: {count}')
+
+        if i % 5 == 0:
+            label = scene.addText(f'{i * bin_size}')
+            label.setPos(x, HISTOGRAM_HEIGHT)
+
+    scene.setSceneRect(scene.itemsBoundingRect())
+
+
+class FramesWidget(QWidget):
+    """Frame time histogram from recorded frame markers, with selection of slow frames."""
+
+    min_frame_ms_changed = pyqtSignal(float)
+
+    def __init__(self):
+        super().__init__()
+        self.setup_ui()
+
+    def setup_ui(self):
+        layout = QVBoxLayout(self)
+        layout.setContentsMargins(0, 0, 0, 0)
+
+        controls = QWidget(self)
+        controls_layout = QHBoxLayout(controls)
+        controls_layout.setContentsMargins(0, 0, 0, 0)
+
+        min_frame_label = QLabel('Profile frames over ms:', controls)
+        controls_layout.addWidget(min_frame_label)
+        self.min_frame_spin = QDoubleSpinBox(controls)
+        self.min_frame_spin.setRange(0.0, 10000.0)
+        self.min_frame_spin.setDecimals(1)
+        self.min_frame_spin.setSingleStep(1.0)
+        self.min_frame_spin.setValue(0.0)
+        self.min_frame_spin.setSpecialValueText('All')
+        self.min_frame_spin.valueChanged.connect(self.on_min_frame_changed)
+        controls_layout.addWidget(self.min_frame_spin)
+
+        self.summary_label = QLabel(controls)
+        controls_layout.addWidget(self.summary_label)
+
+        controls_layout.addStretch(1)
+        layout.addWidget(controls)
+
+        self.scene = QGraphicsScene()
+        self.view = CallGraphView()
+        self.view.setScene(self.scene)
+        layout.addWidget(self.view)
+
+    def on_min_frame_changed(self, value):
+        self.min_frame_ms_changed.emit(float(value))
+
+    def set_profile(self, profile: Profile):
+        frame_times = profile.frame_times_ms
+
+        self.scene.clear()
+        if not frame_times:
+            self.summary_label.setText('No frame markers recorded')
+            return
+
+        frame_times_sorted = sorted(frame_times)
+        p99 = frame_times_sorted[min(len(frame_times_sorted) - 1, int(len(frame_times_sorted) * 0.99))]
+        selected = sum(1 for t in frame_times if t >= profile.min_frame_ms) if profile.min_frame_ms > 0 else len(frame_times)
+        self.summary_label.setText(
+            f'{len(frame_times)} frames, avg {sum(frame_times) / len(frame_times):.1f} ms, '
+            f'99th percentile {p99:.1f} ms, max {frame_times_sorted[-1]:.1f} ms, {selected} selected'
+        )
+
+        draw_histogram(self.scene, frame_times, profile.min_frame_ms)
@@ -0,0 +1,105 @@
+from PyQt6.QtWidgets import (QWidget, QVBoxLayout, QSplitter, QGraphicsScene, QTableWidget, QTableWidgetItem,
+                             QAbstractItemView)
+from PyQt6.QtCore import Qt
+
+from .profile import Profile, IpcStat
+from .timeline_widget import NumberItem
+from .frames_widget import draw_histogram
+from .callgraph_widget import CallGraphView
+
+
+class IpcWidget(QWidget):
+    """IPC request latencies per service command, with histogram and callers of the selected command."""
+
+    def __init__(self):
+        super().__init__()
+        self.profile: Profile | None = None
+        self.stats: list[IpcStat] = []
+        self.setup_ui()
+
+    def setup_ui(self):
+        layout = QVBoxLayout(self)
+        layout.setContentsMargins(0, 0, 0, 0)
+
+        splitter = QSplitter(Qt.Orientation.Vertical, self)
+
+        self.table = QTableWidget(splitter)
+        self.table.setColumnCount(6)
+        self.table.setHorizontalHeaderLabels(['Service', 'Command', 'Calls', 'Total ms', 'Avg us', 'Max us'])
+        self.table.setSelectionBehavior(QAbstractItemView.SelectionBehavior.SelectRows)
+        self.table.setSelectionMode(QAbstractItemView.SelectionMode.SingleSelection)
+        self.table.setEditTriggers(QAbstractItemView.EditTrigger.NoEditTriggers)
+        self.table.setSortingEnabled(True)
+        self.table.verticalHeader().setVisible(False)
+        self.table.itemSelectionChanged.connect(self.on_selection_changed)
+        splitter.addWidget(self.table)
+
+        details = QSplitter(Qt.Orientation.Horizontal, splitter)
+
+        self.scene = QGraphicsScene()
+        self.view = CallGraphView()
+        self.view.setScene(self.scene)
+        details.addWidget(self.view)
+
+        self.callers_table = QTableWidget(details)
+        self.callers_table.setColumnCount(3)
+        self.callers_table.setHorizontalHeaderLabels(['Caller', 'Calls', 'Total ms'])
+        self.callers_table.setEditTriggers(QAbstractItemView.EditTrigger.NoEditTriggers)
+        self.callers_table.setSortingEnabled(True)
+        self.callers_table.verticalHeader().setVisible(False)
+        details.addWidget(self.callers_table)
+
+        splitter.addWidget(details)
+        layout.addWidget(splitter)
+
+    def ticks_to_us(self, ticks: int) -> float:
+        return self.profile.ticks_to_ms(ticks) * 1000
+
+    def set_profile(self, profile: Profile):
+        self.profile = profile
+        self.stats = sorted(profile.ipc.values(), key=lambda s: sum(s.latencies), reverse=True)
+
+        self.table.setSortingEnabled(False)
+        self.table.setRowCount(len(self.stats))
+        for row, stat in enumerate(self.stats):
+            # Row index kept in the first item, rows move when sorting
+            service_item = QTableWidgetItem(stat.service)
+            service_item.setData(Qt.ItemDataRole.UserRole, row)
+            self.table.setItem(row, 0, service_item)
+            self.table.setItem(row, 1, NumberItem(stat.command_id, f'0x{stat.command_id:04X}'))
+            self.table.setItem(row, 2, NumberItem(len(stat.latencies), f'{len(stat.latencies)}'))
+            total_ms = profile.ticks_to_ms(sum(stat.latencies))
+            self.table.setItem(row, 3, NumberItem(total_ms, f'{total_ms:.2f}'))
+            avg_us = self.ticks_to_us(sum(stat.latencies) / len(stat.latencies))
+            self.table.setItem(row, 4, NumberItem(avg_us, f'{avg_us:.0f}'))
+            max_us = self.ticks_to_us(max(stat.latencies))
+            self.table.setItem(row, 5, NumberItem(max_us, f'{max_us:.0f}'))
+        self.table.setSortingEnabled(True)
+
+        self.show_details(None)
+
+    def on_selection_changed(self):
+        rows = self.table.selectionModel().selectedRows()
+        if not rows:
+            self.show_details(None)
+            return
+        index = self.table.item(rows[0].row(), 0).data(Qt.ItemDataRole.UserRole)
+        self.show_details(self.stats[index])
+
+    def show_details(self, stat: IpcStat | None):
+        self.scene.clear()
+        self.callers_table.setSortingEnabled(False)
+        self.callers_table.setRowCount(0)
+        if stat is None:
+            return
+
+        draw_histogram(self.scene, [self.ticks_to_us(t) for t in stat.latencies], unit='us')
+
+        callers = sorted(stat.callers.items(), key=lambda c: sum(c[1]), reverse=True)
+        self.callers_table.setRowCount(len(callers))
+        for row, (caller, latencies) in enumerate(callers):
+            self.callers_table.setItem(row, 0, QTableWidgetItem(caller))
+            self.callers_table.setItem(row, 1, NumberItem(len(latencies), f'{len(latencies)}'))
+            total_ms = self.profile.ticks_to_ms(sum(latencies))
+            self.callers_table.setItem(row, 2, NumberItem(total_ms, f'{total_ms:.2f}'))
+        self.callers_table.setSortingEnabled(True)
@@ -8,6 +8,11 @@ from .symbols import SymbolMap
 from .profile import Profile
 from .callgraph import generate_callgraph
 from .callgraph_widget import CallGraphWidget
+from .timeline_widget import TimelineWidget
+from .frames_widget import FramesWidget
+from .blocking_widget import BlockingWidget
+from .ipc_widget import IpcWidget
+from .quality_widget import QualityWidget
 
 
 class FunctionTableModel(QAbstractTableModel):
@@ -16,10 +21,14 @@ class FunctionTableModel(QAbstractTableModel):
     def __init__(self):
         super().__init__()
         self.funcs = []
+        self.miss_event = None
+        self.miss_event_name = ''
     
-    def set_data(self, funcs):
+    def set_data(self, funcs, miss_event=None, miss_event_name=''):
         self.beginResetModel()
         self.funcs = funcs
+        self.miss_event = miss_event
+        self.miss_event_name = miss_event_name
         self.endResetModel()
     
     def rowCount(self, parent=QModelIndex()):
@@ -28,7 +37,7 @@ class FunctionTableModel(QAbstractTableModel):
         return len(self.funcs)
     
     def columnCount(self, parent=QModelIndex()):
-        return 4
+        return 6
     
     def data(self, index, role=Qt.ItemDataRole.DisplayRole):
         if not index.isValid() or index.row() >= len(self.funcs):
@@ -42,21 +51,32 @@ class FunctionTableModel(QAbstractTableModel):
             elif index.column() == 1:
                 return func.name
             elif index.column() == 2:
-                return str(func.hit_count)
+                return f'{func.hit_count:.0f}'
             elif index.column() == 3:
-                return str(func.hit_count_direct)
+                return f'{func.hit_count_direct:.0f}'
+            elif index.column() == 4:
+                cpi = func.cpi
+                return '' if cpi is None else f'{cpi:.2f}'
+            elif index.column() == 5:
+                mpki = func.per_kilo_instructions(self.miss_event)
+                return '' if mpki is None else f'{mpki:.2f}'
         
         elif role == Qt.ItemDataRole.TextAlignmentRole:
-            if index.column() in (0, 2, 3):
+            if index.column() in (0, 2, 3, 4, 5):
                 return Qt.AlignmentFlag.AlignRight | Qt.AlignmentFlag.AlignVCenter
         
         return None
     
     def headerData(self, section, orientation, role=Qt.ItemDataRole.DisplayRole):
         if role == Qt.ItemDataRole.DisplayRole and orientation == Qt.Orientation.Horizontal:
-            headers = ['Address', 'Name', 'Total Hits', 'Direct Hits']
+            headers = ['Address', 'Name', 'Total Hits', 'Direct Hits', 'CPI', 'MPKI']
             if section < len(headers):
                 return headers[section]
+        if role == Qt.ItemDataRole.ToolTipRole and orientation == Qt.Orientation.Horizontal:
+            if section == 4:
+                return 'Cycles per instruction'
+            elif section == 5 and self.miss_event_name:
+                return f'{self.miss_event_name} per 1000 instructions'
         return None
     
     def sort(self, column, order):
@@ -70,6 +90,10 @@ class FunctionTableModel(QAbstractTableModel):
             self.funcs.sort(key=lambda f: f.hit_count, reverse=reverse)
         elif column == 3:
             self.funcs.sort(key=lambda f: f.hit_count_direct, reverse=reverse)
+        elif column == 4:
+            self.funcs.sort(key=lambda f: f.cpi or 0, reverse=reverse)
+        elif column == 5:
+            self.funcs.sort(key=lambda f: f.per_kilo_instructions(self.miss_event) or 0, reverse=reverse)
         self.endResetModel()
 
 
@@ -78,7 +102,8 @@ class MainWindow(QMainWindow):
         self,
         initial_file_path: Optional[str] = None,
         initial_symbol_paths: Optional[list[str]] = None,
-        initial_code_paths: Optional[list[tuple[str, int]]] = None
+        initial_code_paths: Optional[list[tuple[str, int]]] = None,
+        initial_module_symbol_paths: Optional[list[tuple[str, str]]] = None
     ):
         super().__init__()
 
@@ -89,6 +114,9 @@ class MainWindow(QMainWindow):
         if initial_code_paths:
             for path, addr in initial_code_paths:
                 self.symbols.load_code_from_file(path, addr)
+        if initial_module_symbol_paths:
+            for path, module_name in initial_module_symbol_paths:
+                self.symbols.add_module_symbols(path, module_name)
 
         self.profile = Profile(self.symbols)
         if initial_file_path:
@@ -164,6 +192,13 @@ class MainWindow(QMainWindow):
         self.critical_kind_combo.currentIndexChanged.connect(self.on_critical_kind_changed)
         controls_layout.addWidget(self.critical_kind_combo)
 
+        core_label = QLabel('Core:', controls)
+        controls_layout.addWidget(core_label)
+        self.core_combo = QComboBox(controls)
+        self.core_combo.addItems(['All', '0', '1', '2', '3'])
+        self.core_combo.currentIndexChanged.connect(self.on_core_changed)
+        controls_layout.addWidget(self.core_combo)
+
         controls_layout.addStretch(1)
         cg_layout.addWidget(controls)
 
@@ -186,6 +221,26 @@ class MainWindow(QMainWindow):
 
         tabs.addTab(functions_tab, 'Functions')
 
+        # --- Threads tab ---
+        self.timeline_widget = TimelineWidget()
+        tabs.addTab(self.timeline_widget, 'Threads')
+
+        # --- Frames tab ---
+        self.frames_widget = FramesWidget()
+        self.frames_widget.min_frame_ms_changed.connect(self.on_min_frame_ms_changed)
+        tabs.addTab(self.frames_widget, 'Frames')
+
+        # --- Blocking tab ---
+        self.blocking_widget = BlockingWidget()
+        tabs.addTab(self.blocking_widget, 'Blocking')
+
+        # --- IPC tab ---
+        self.ipc_widget = IpcWidget()
+        tabs.addTab(self.ipc_widget, 'IPC')
+
+        self.quality_widget = QualityWidget()
+        tabs.addTab(self.quality_widget, 'Capture Quality')
+
         self.setCentralWidget(tabs)
         
         self.update_list()
@@ -231,9 +286,31 @@ class MainWindow(QMainWindow):
         self.callgraph_widget.load_from_dot(dot)
 
     def update_list(self):
-        self.model.set_data(self.profile.funcs)
+        title = f'NextProf Viewer - {self.profile.event_name}'
+        session = self.profile.session
+        if session is not None:
+            title += f' - {session.process_name} ({session.program_id:016X})'
+        if self.profile.dropped_samples:
+            title += f' - {self.profile.dropped_samples} samples dropped'
+        self.setWindowTitle(title)
+        miss_event = self.profile.miss_event
+        miss_event_name = '' if miss_event is None else self.profile.get_event_name(miss_event)
+        self.model.set_data(self.profile.funcs, miss_event, miss_event_name)
+        self.timeline_widget.set_profile(self.profile)
+        self.frames_widget.set_profile(self.profile)
+        self.blocking_widget.set_profile(self.profile)
+        self.ipc_widget.set_profile(self.profile)
+        self.quality_widget.set_profile(self.profile)
         self.refresh_callgraph()
 
+    def on_min_frame_ms_changed(self, value):
+        self.profile.set_min_frame_ms(value)
+        self.update_list()
+
+    def on_core_changed(self, index):
+        self.profile.set_core_filter(index - 1 if index > 0 else None)
+        self.update_list()
+
     def on_threshold_changed(self, _value):
         self.refresh_callgraph()
 
@@ -15,7 +15,7 @@ class PacketSample:
     @staticmethod
     def parse(data: memoryview) -> 'PacketSample':
         stack_size = int.from_bytes(data[16:20], 'little')
-        stack = [int.from_bytes(data[20 + i*4:24 + i*4], 'little') for i in range(stack_size)]
+        stack = [int.from_bytes(data[20 + i*4:24 + i*4], 'little') for i in range(stack_size // 4)]
         return PacketSample(
             thread_id=int.from_bytes(data[4:8], 'little'),
             pc=int.from_bytes(data[8:12], 'little'),
@@ -25,22 +25,560 @@ class PacketSample:
 
     @property
     def size(self) -> int:
-        return 5*4 + len(self.stack)
+        return 5*4 + len(self.stack)*4
 
-_packet_classes = [PacketSample]
+@dataclass
+class PacketSampleChain:
+    KIND = 2
+
+    thread_id: int
+    pc: int
+    lr: int
+    chain: list[int]
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketSampleChain':
+        chain_count = int.from_bytes(data[16:20], 'little')
+        chain = [int.from_bytes(data[20 + i*4:24 + i*4], 'little') for i in range(chain_count)]
+        return PacketSampleChain(
+            thread_id=int.from_bytes(data[4:8], 'little'),
+            pc=int.from_bytes(data[8:12], 'little'),
+            lr=int.from_bytes(data[12:16], 'little'),
+            chain=chain,
+        )
+
+    @property
+    def size(self) -> int:
+        return 5*4 + len(self.chain)*4
+
+@dataclass
+class PacketAggregate:
+    KIND = 3
+
+    thread_id: int
+    pc: int
+    count: int
+    chain: list[int]
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketAggregate':
+        chain_count = int.from_bytes(data[16:20], 'little')
+        chain = [int.from_bytes(data[20 + i*4:24 + i*4], 'little') for i in range(chain_count)]
+        return PacketAggregate(
+            thread_id=int.from_bytes(data[4:8], 'little'),
+            pc=int.from_bytes(data[8:12], 'little'),
+            count=int.from_bytes(data[12:16], 'little'),
+            chain=chain,
+        )
+
+    @property
+    def size(self) -> int:
+        return 5*4 + len(self.chain)*4
+
+@dataclass
+class PacketInterval:
+    KIND = 4
+
+    interval: int
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketInterval':
+        return PacketInterval(
+            interval=int.from_bytes(data[4:8], 'little'),
+        )
+
+    @property
+    def size(self) -> int:
+        return 2*4
+
+@dataclass
+class PacketEvent:
+    KIND = 5
+
+    event: int
+    counter_event: int
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketEvent':
+        return PacketEvent(
+            event=int.from_bytes(data[4:8], 'little'),
+            counter_event=int.from_bytes(data[8:12], 'little'),
+        )
+
+    @property
+    def size(self) -> int:
+        return 3*4
+
+@dataclass
+class PacketCounters:
+    KIND = 6
+
+    cycles: int
+    event_count: int
+    counter_count: int
+    thread_id: int  # Running on the overflowed core, 0xFFFFFFFF if none of the debuggee's was
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketCounters':
+        return PacketCounters(
+            cycles=int.from_bytes(data[4:8], 'little'),
+            event_count=int.from_bytes(data[8:12], 'little'),
+            counter_count=int.from_bytes(data[12:16], 'little'),
+            thread_id=int.from_bytes(data[16:20], 'little'),
+        )
+
+    @property
+    def size(self) -> int:
+        return 5*4
+
+@dataclass
+class PacketScheduleIn:
+    KIND = 7
+
+    thread_id: int
+    core: int
+    tick: int
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketScheduleIn':
+        return PacketScheduleIn(
+            thread_id=int.from_bytes(data[4:8], 'little'),
+            core=int.from_bytes(data[8:12], 'little'),
+            tick=int.from_bytes(data[12:20], 'little'),
+        )
+
+    @property
+    def size(self) -> int:
+        return 5*4
+
+@dataclass
+class PacketScheduleOut:
+    KIND = 8
+
+    thread_id: int
+    core: int
+    tick: int
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketScheduleOut':
+        return PacketScheduleOut(
+            thread_id=int.from_bytes(data[4:8], 'little'),
+            core=int.from_bytes(data[8:12], 'little'),
+            tick=int.from_bytes(data[12:20], 'little'),
+        )
+
+    @property
+    def size(self) -> int:
+        return 5*4
+
+@dataclass
+class PacketSession:
+    KIND = 9
+
+    version: int
+    tick_frequency: int
+    program_id: int
+    process_name: str
+    start_tick: int
+    interval: int
+    stack_size: int
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketSession':
+        return PacketSession(
+            version=int.from_bytes(data[4:8], 'little'),
+            tick_frequency=int.from_bytes(data[8:12], 'little'),
+            program_id=int.from_bytes(data[12:20], 'little'),
+            process_name=bytes(data[20:28]).rstrip(b'\0').decode('ascii', errors='replace'),
+            start_tick=int.from_bytes(data[28:36], 'little'),
+            interval=int.from_bytes(data[36:40], 'little'),
+            stack_size=int.from_bytes(data[40:44], 'little'),
+        )
+
+    @property
+    def size(self) -> int:
+        return 11*4
+
+@dataclass
+class PacketBreak:
+    KIND = 10
+
+    tick: int
+    core: int
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketBreak':
+        return PacketBreak(
+            tick=int.from_bytes(data[4:12], 'little'),
+            core=int.from_bytes(data[12:16], 'little'),
+        )
+
+    @property
+    def size(self) -> int:
+        return 4*4
+
+@dataclass
+class PacketFrame:
+    KIND = 11
+
+    thread_id: int
+    tick: int
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketFrame':
+        return PacketFrame(
+            thread_id=int.from_bytes(data[4:8], 'little'),
+            tick=int.from_bytes(data[8:16], 'little'),
+        )
+
+    @property
+    def size(self) -> int:
+        return 4*4
+
+@dataclass
+class PacketSyscallIn:
+    KIND = 12
+
+    thread_id: int
+    syscall: int
+    tick: int
+    pc: int
+    lr: int
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketSyscallIn':
+        return PacketSyscallIn(
+            thread_id=int.from_bytes(data[4:8], 'little'),
+            syscall=int.from_bytes(data[8:12], 'little'),
+            tick=int.from_bytes(data[12:20], 'little'),
+            pc=int.from_bytes(data[20:24], 'little'),
+            lr=int.from_bytes(data[24:28], 'little'),
+        )
+
+    @property
+    def size(self) -> int:
+        return 7*4
+
+@dataclass
+class PacketSyscallOut:
+    KIND = 13
+
+    thread_id: int
+    syscall: int
+    tick: int
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketSyscallOut':
+        return PacketSyscallOut(
+            thread_id=int.from_bytes(data[4:8], 'little'),
+            syscall=int.from_bytes(data[8:12], 'little'),
+            tick=int.from_bytes(data[12:20], 'little'),
+        )
+
+    @property
+    def size(self) -> int:
+        return 5*4
+
+@dataclass
+class PacketService:
+    KIND = 14
+
+    handle: int
+    name: str
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketService':
+        return PacketService(
+            handle=int.from_bytes(data[4:8], 'little'),
+            name=bytes(data[8:20]).split(b'\0', 1)[0].decode('ascii', errors='replace'),
+        )
+
+    @property
+    def size(self) -> int:
+        return 5*4
+
+@dataclass
+class PacketIpcRequest:
+    KIND = 15
+
+    thread_id: int
+    handle: int
+    command_header: int
+    tick: int
+    lr: int
+    chain: list[int]
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketIpcRequest':
+        chain_count = int.from_bytes(data[28:32], 'little')
+        return PacketIpcRequest(
+            thread_id=int.from_bytes(data[4:8], 'little'),
+            handle=int.from_bytes(data[8:12], 'little'),
+            command_header=int.from_bytes(data[12:16], 'little'),
+            tick=int.from_bytes(data[16:24], 'little'),
+            lr=int.from_bytes(data[24:28], 'little'),
+            chain=[int.from_bytes(data[32 + i*4:36 + i*4], 'little') for i in range(chain_count)],
+        )
+
+    @property
+    def size(self) -> int:
+        return 8*4 + len(self.chain)*4
+
+@dataclass
+class PacketIpcReply:
+    KIND = 16
+
+    thread_id: int
+    tick: int
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketIpcReply':
+        return PacketIpcReply(
+            thread_id=int.from_bytes(data[4:8], 'little'),
+            tick=int.from_bytes(data[8:16], 'little'),
+        )
+
+    @property
+    def size(self) -> int:
+        return 4*4
+
+@dataclass
+class PacketModule:
+    KIND = 17
+
+    addr: int
+    size_bytes: int
+    perm: int
+    state: int
+    name: str
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketModule':
+        return PacketModule(
+            addr=int.from_bytes(data[4:8], 'little'),
+            size_bytes=int.from_bytes(data[8:12], 'little'),
+            perm=int.from_bytes(data[12:16], 'little'),
+            state=int.from_bytes(data[16:20], 'little'),
+            name=bytes(data[20:36]).split(b'\0', 1)[0].decode('ascii', errors='replace'),
+        )
+
+    @property
+    def size(self) -> int:
+        return 9*4
+
+@dataclass
+class PacketStats:
+    KIND = 18
+
+    tick: int
+    elapsed: int
+    samples: int
+    # (count, min, max, total) ticks per phase
+    phases: list[tuple[int, int, int, int]]
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketStats':
+        phase_count = int.from_bytes(data[24:28], 'little')
+        phases = []
+        for i in range(phase_count):
+            base = 28 + i*20
+            phases.append((
+                int.from_bytes(data[base:base + 4], 'little'),
+                int.from_bytes(data[base + 4:base + 8], 'little'),
+                int.from_bytes(data[base + 8:base + 12], 'little'),
+                int.from_bytes(data[base + 12:base + 20], 'little'),
+            ))
+        return PacketStats(
+            tick=int.from_bytes(data[4:12], 'little'),
+            elapsed=int.from_bytes(data[12:20], 'little'),
+            samples=int.from_bytes(data[20:24], 'little'),
+            phases=phases,
+        )
+
+    @property
+    def size(self) -> int:
+        return 7*4 + len(self.phases)*5*4
+
+@dataclass
+class PacketDropped:
+    KIND = 19
+
+    tick: int
+    samples: int
+    packets: int
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketDropped':
+        return PacketDropped(
+            tick=int.from_bytes(data[4:12], 'little'),
+            samples=int.from_bytes(data[12:16], 'little'),
+            packets=int.from_bytes(data[16:20], 'little'),
+        )
+
+    @property
+    def size(self) -> int:
+        return 5*4
+
+@dataclass
+class PacketSampleDelta:
+    KIND = 20
+
+    thread_id: int
+    pc: int
+    lr: int
+    sp: int
+    stack_size: int
+    # Trailing words equal to the previous stack of the thread at the same addresses, not included in changed
+    suffix_count: int
+    changed: list[int]
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketSampleDelta':
+        stack_size = int.from_bytes(data[20:24], 'little')
+        suffix_count = int.from_bytes(data[24:28], 'little')
+        changed_count = stack_size // 4 - suffix_count
+        changed = [int.from_bytes(data[28 + i*4:32 + i*4], 'little') for i in range(changed_count)]
+        return PacketSampleDelta(
+            thread_id=int.from_bytes(data[4:8], 'little'),
+            pc=int.from_bytes(data[8:12], 'little'),
+            lr=int.from_bytes(data[12:16], 'little'),
+            sp=int.from_bytes(data[16:20], 'little'),
+            stack_size=stack_size,
+            suffix_count=suffix_count,
+            changed=changed,
+        )
+
+    @property
+    def size(self) -> int:
+        return 7*4 + len(self.changed)*4
+
+@dataclass
+class PacketChainDefine:
+    KIND = 21
+
+    chain_id: int
+    chain: list[int]
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketChainDefine':
+        chain_count = int.from_bytes(data[8:12], 'little')
+        chain = [int.from_bytes(data[12 + i*4:16 + i*4], 'little') for i in range(chain_count)]
+        return PacketChainDefine(
+            chain_id=int.from_bytes(data[4:8], 'little'),
+            chain=chain,
+        )
+
+    @property
+    def size(self) -> int:
+        return 3*4 + len(self.chain)*4
+
+@dataclass
+class PacketSampleRef:
+    KIND = 22
+
+    thread_id: int
+    pc: int
+    chain_id: int
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketSampleRef':
+        return PacketSampleRef(
+            thread_id=int.from_bytes(data[4:8], 'little'),
+            pc=int.from_bytes(data[8:12], 'little'),
+            chain_id=int.from_bytes(data[12:16], 'little'),
+        )
+
+    @property
+    def size(self) -> int:
+        return 4*4
+
+@dataclass
+class PacketSamplePc:
+    KIND = 23
+
+    thread_slot: int
+    pc: int
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketSamplePc':
+        # Slot is stored in the upper byte of the kind to fit in 8 bytes
+        return PacketSamplePc(
+            thread_slot=data[3],
+            pc=int.from_bytes(data[4:8], 'little'),
+        )
+
+    @property
+    def size(self) -> int:
+        return 2*4
+
+@dataclass
+class PacketThreadSlot:
+    KIND = 24
+
+    slot: int
+    thread_id: int
+
+    @staticmethod
+    def parse(data: memoryview) -> 'PacketThreadSlot':
+        return PacketThreadSlot(
+            slot=int.from_bytes(data[4:8], 'little'),
+            thread_id=int.from_bytes(data[8:12], 'little'),
+        )
+
+    @property
+    def size(self) -> int:
+        return 3*4
+
+class StackDeltaDecoder:
+    """Rebuilds full stack samples from delta samples, which have to be passed in capture order."""
+
+    def __init__(self):
+        self.stacks: dict[int, tuple[int, list[int]]] = {}  # thread_id -> (sp, stack)
+
+    def decode(self, packet: PacketSampleDelta) -> PacketSample | None:
+        stack = packet.changed
+        if packet.suffix_count > 0:
+            previous = self.stacks.get(packet.thread_id)
+            # Capture started after the last keyframe
+            if previous is None:
+                return None
+            previous_sp, previous_stack = previous
+            start = (packet.sp + len(packet.changed) * 4 - previous_sp) // 4
+            stack = stack + previous_stack[start:start + packet.suffix_count]
+
+        self.stacks[packet.thread_id] = (packet.sp, stack)
+        return PacketSample(thread_id=packet.thread_id, pc=packet.pc, lr=packet.lr, stack=stack)
+
+_packet_classes = [
+    PacketSample, PacketSampleChain, PacketAggregate, PacketInterval, PacketEvent, PacketCounters,
+    PacketScheduleIn, PacketScheduleOut, PacketSession, PacketBreak, PacketFrame,
+    PacketSyscallIn, PacketSyscallOut, PacketService, PacketIpcRequest, PacketIpcReply, PacketModule,
+    PacketStats, PacketDropped, PacketSampleDelta, PacketChainDefine, PacketSampleRef,
+    PacketSamplePc, PacketThreadSlot,
+]
 
 _packets_by_kind = {
     c.KIND: c
     for c in _packet_classes
 }
 
-def parse_packet(data: memoryview) -> PacketSample:
+def parse_packet(data: memoryview):
+    """Parses the packet at the start of data, None if data ends before the packet does."""
+    # Captures end mid-packet if the device crashed or the card filled up
     if len(data) < 4:
-        raise ValueError('Data too short to contain packet kind')
+        return None
     if data[0:2] != PACKET_MAGIC:
         raise ValueError('Invalid packet magic')
-    kind = int.from_bytes(data[2:4], 'little')
+    # Kinds fit in one byte, the other may hold packet data
+    kind = data[2]
     cls = _packets_by_kind.get(kind)
     if cls is None:
         raise ValueError(f'Unknown packet kind: {kind}')
-    return cls.parse(data)
+    # Sizes only depend on fields before the variable part, a cut off field makes the size exceed the data
+    try:
+        packet = cls.parse(data)
+    except (IndexError, ValueError):
+        return None
+    if packet.size > len(data):
+        return None
+    return packet
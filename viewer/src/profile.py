@@ -1,26 +1,194 @@
-from .packet import parse_packet, PacketSample
+from bisect import bisect_right
+
+from .packet import (parse_packet, PacketSample, PacketSampleChain, PacketAggregate, PacketInterval, PacketEvent, PacketCounters,
+                     PacketScheduleIn, PacketScheduleOut, PacketSession, PacketBreak, PacketFrame,
+                     PacketSyscallIn, PacketSyscallOut, PacketService, PacketIpcRequest, PacketIpcReply, PacketModule,
+                     PacketStats, PacketDropped, PacketSampleDelta, StackDeltaDecoder,
+                     PacketChainDefine, PacketSampleRef, PacketSamplePc, PacketThreadSlot)
 from .symbols import SymbolMap
+from .compression import is_compressed, decompress_frames
 
 from dataclasses import dataclass, field
 
 
+# MPCore performance monitor events that can drive sampling
+EVENT_NAMES = {
+    0x00: 'Instruction Cache Misses',
+    0x01: 'Instruction Stalls',
+    0x02: 'Data Hazard Stalls',
+    0x03: 'Instruction MicroTLB Misses',
+    0x04: 'Data MicroTLB Misses',
+    0x05: 'Branches',
+    0x06: 'Branches Not Predicted',
+    0x07: 'Branch Mispredictions',
+    0x08: 'Instructions',
+    0x0B: 'Data Cache Read Misses',
+    0x0D: 'Data Cache Write Misses',
+    0x10: 'Main TLB Misses',
+    0x12: 'LSU Full Stalls',
+    0xFF: 'Cycles',
+}
+
+EVENT_INSTRUCTIONS = 0x08
+EVENT_CYCLES = 0xFF
+
+# ARM11 system tick rate, used if the capture has no session packet
+TICKS_PER_SECOND = 268111856
+
+MEMPERM_EXECUTE = 4
+
+# Newest capture format this viewer can read
+FORMAT_VERSION = 3
+
+# Syscalls a thread blocks in, time spent in them is off-CPU time
+BLOCKING_SYSCALLS = {
+    0x0A: 'SleepThread',
+    0x22: 'ArbitrateAddress',
+    0x24: 'WaitSynchronization1',
+    0x25: 'WaitSynchronizationN',
+}
+
+# Profiler phases in the order of the statistics packet
+STATS_PHASE_NAMES = ['Wait', 'Break', 'Context', 'Stack', 'Record', 'Flush', 'Sample']
+STATS_PHASE_FLUSH = 5
+STATS_PHASE_SAMPLE = 6
+
+
 @dataclass
 class Function:
     address: int
     name: str
-    hit_count: int = 0
-    hit_count_direct: int = 0
-    callees: dict[int, int] = field(default_factory=dict)   # callee_addr -> call_count
+    hit_count: float = 0
+    hit_count_direct: float = 0
+    callees: dict[int, float] = field(default_factory=dict)   # callee_addr -> call_count
+    counters: dict[int, float] = field(default_factory=dict)  # event -> count while directly in this function
+
+    @property
+    def cpi(self) -> float | None:
+        instructions = self.counters.get(EVENT_INSTRUCTIONS)
+        if not instructions or EVENT_CYCLES not in self.counters:
+            return None
+        return self.counters[EVENT_CYCLES] / instructions
+
+    def per_kilo_instructions(self, event: int | None) -> float | None:
+        instructions = self.counters.get(EVENT_INSTRUCTIONS)
+        if event is None or not instructions or event not in self.counters:
+            return None
+        return self.counters[event] * 1000 / instructions
     
 
+@dataclass
+class ThreadSchedule:
+    thread_id: int
+    run_ticks: int = 0
+    switches: int = 0
+    slices: list[tuple[int, int, int]] = field(default_factory=list)  # (start_tick, end_tick, core)
+    running_since: int | None = None
+    running_core: int = 0
+
+
+@dataclass
+class BlockingStat:
+    caller_addr: int
+    caller_name: str
+    syscall: int
+    count: int = 0
+    ticks: int = 0
+    max_ticks: int = 0
+
+
+@dataclass
+class IpcStat:
+    service: str
+    command_id: int
+    latencies: list[int] = field(default_factory=list)
+    callers: dict[str, list[int]] = field(default_factory=dict)  # caller stack -> latencies
+
+
+@dataclass
+class PhaseStat:
+    name: str
+    count: int = 0
+    min_ticks: int = 0
+    max_ticks: int = 0
+    ticks: int = 0
+
+
 class Profile:
 
     def __init__(self, symbols: SymbolMap):
         self.symbols = symbols
+
+        # All loaded packets, replayed whenever the selection changes
+        self.packets: list = []
+
+        # Only samples in frames taking at least this long are counted if not 0
+        self.min_frame_ms = 0.0
+
+        # Only samples of breaks triggered on this core are counted if not None
+        self.core_filter: int | None = None
+
+        # Delta samples are stored as full samples, decoding has to continue where the last load ended
+        self.stack_decoder = StackDeltaDecoder()
+
+        # Chains by ID as last defined by the device, references are resolved to chain samples while loading
+        self.chain_defs: dict[int, list[int]] = {}
+
+        # Thread IDs by the slot compact pc samples refer to them with
+        self.thread_slots: dict[int, int] = {}
+
+        # Frames are cut regardless of packets, the decoded start of a packet cut off at the last complete frame
+        # is kept and continued with when the next load resumes at the returned position
+        self.compressed_tail = b''
+        self.compressed_tail_resume: tuple[str, int] | None = None
+
+        self.reset()
+
+    def reset(self):
         self.funcs = list[Function]()
         self.funcs_by_addr: dict[int, Function] = {}
 
-    def track_hit(self, addr: int, direct: bool = True):
+        # Samples are weighted relative to the first sampling interval seen
+        self.base_interval: int | None = None
+        self.interval_weight = 1.0
+
+        self.event = EVENT_CYCLES
+        self.counter_event = EVENT_INSTRUCTIONS
+
+        # Counter deltas of the overflowed core in the current break, applied to the sample of the thread running there
+        self.break_counters: dict[int, int] | None = None
+        self.break_counters_thread: int | None = None
+
+        self.session: PacketSession | None = None
+
+        # Tick of the current break and (tick, weight) of every sample for time based views
+        self.break_tick: int | None = None
+        self.break_core: int | None = None
+        self.sample_ticks: list[tuple[int, float]] = []
+
+        self.threads: dict[int, ThreadSchedule] = {}
+        self.first_tick: int | None = None
+        self.last_tick: int | None = None
+
+        # Frame start ticks, collected before the other packets are handled
+        self.frame_ticks: list[int] = []
+
+        # Pending syscall entry per thread and blocked time per (caller_addr, syscall)
+        self.syscalls_in: dict[int, PacketSyscallIn] = {}
+        self.blocking: dict[tuple[int, int], BlockingStat] = {}
+
+        # Service names per session handle, pending request per thread and latencies per (service, command_id)
+        self.services: dict[int, str] = {}
+        self.ipc_requests: dict[int, tuple[PacketIpcRequest, str]] = {}
+        self.ipc: dict[tuple[str, int], IpcStat] = {}
+
+        # Periodic statistics of the profiler's own overhead
+        self.stats: list[PacketStats] = []
+
+        # Samples and packets the sysmodule dropped with OnFull=Drop, recorded after each gap
+        self.dropped: list[PacketDropped] = []
+
+    def track_hit(self, addr: int, direct: bool = True, weight: float = 1):
         func_name = self.symbols.get(addr)
         if func_name is None:
             return
@@ -29,9 +197,9 @@ class Profile:
             self.funcs_by_addr[addr] = func
             self.funcs.append(func)
         func = self.funcs_by_addr[addr]
-        func.hit_count += 1
+        func.hit_count += weight
         if direct:
-            func.hit_count_direct += 1
+            func.hit_count_direct += weight
     
     def break_trace(self, addr: int) -> bool:
         # TODO: use thread entry pc
@@ -62,19 +230,269 @@ class Profile:
             print(f' {i*4:04X} - {s}')
 
     def handle_sample_packet(self, packet: PacketSample):
+        if not self.is_break_selected():
+            return
+
         stack_return_addrs = [
             addr for addr in packet.stack
             if self.symbols.is_executable(addr) and self.symbols.is_after_bl(addr)
         ]
 
-        stack_return_addrs_exec = [
-            addr for addr in packet.stack
-            if self.symbols.is_executable(addr)
-        ]
+        self.track_sample_tick(self.interval_weight)
+        self.handle_call_chain(packet.pc, stack_return_addrs, weight=self.interval_weight, counters=self.sample_counters(packet.thread_id))
+
+    def handle_sample_chain_packet(self, packet: PacketSampleChain):
+        if not self.is_break_selected():
+            return
+
+        # Already filtered on device
+        self.track_sample_tick(self.interval_weight)
+        self.handle_call_chain(packet.pc, packet.chain, weight=self.interval_weight, counters=self.sample_counters(packet.thread_id))
+
+    def sample_counters(self, thread_id: int) -> dict[int, int] | None:
+        # Other sampled threads were not running on the core while it counted, or were blocked
+        if thread_id != self.break_counters_thread:
+            return None
+        return self.break_counters
 
+    def handle_aggregate_packet(self, packet: PacketAggregate):
+        # One packet stands for count samples with the same call chain
+        self.handle_call_chain(packet.pc, packet.chain, weight=packet.count * self.interval_weight)
+
+    def handle_interval_packet(self, packet: PacketInterval):
+        if self.base_interval is None:
+            self.base_interval = packet.interval
+        self.interval_weight = packet.interval / self.base_interval
+
+    def handle_event_packet(self, packet: PacketEvent):
+        self.event = packet.event
+        self.counter_event = packet.counter_event
+
+    def handle_counters_packet(self, packet: PacketCounters):
+        # Cycles last, the cycle counter is exact even if an event counter counts cycles too
+        self.break_counters = {
+            self.event: packet.event_count,
+            self.counter_event: packet.counter_count,
+            EVENT_CYCLES: packet.cycles,
+        }
+        self.break_counters_thread = packet.thread_id
+
+    def handle_session_packet(self, packet: PacketSession):
+        self.session = packet
+
+    def handle_break_packet(self, packet: PacketBreak):
+        self.break_tick = packet.tick
+        self.break_core = packet.core
+        self.break_counters = None
+        self.break_counters_thread = None
+        self.track_tick(packet.tick)
+
+    def handle_frame_packet(self, packet: PacketFrame):
+        self.track_tick(packet.tick)
+
+    def handle_syscall_in_packet(self, packet: PacketSyscallIn):
+        self.track_tick(packet.tick)
+        if packet.syscall in BLOCKING_SYSCALLS:
+            self.syscalls_in[packet.thread_id] = packet
+
+    def handle_syscall_out_packet(self, packet: PacketSyscallOut):
+        self.track_tick(packet.tick)
+        entry = self.syscalls_in.pop(packet.thread_id, None)
+        if entry is None or entry.syscall != packet.syscall:
+            return
+
+        # pc is inside the syscall wrapper, lr points into the function that called it
+        caller_addr, caller_name = self.symbols.get_nearest(entry.lr)
+        if caller_name is None:
+            caller_addr, caller_name = self.symbols.get_nearest(entry.pc)
+        if caller_name is None:
+            caller_addr, caller_name = entry.lr, f'0x{entry.lr:08X}'
+
+        key = (caller_addr, entry.syscall)
+        if key not in self.blocking:
+            self.blocking[key] = BlockingStat(caller_addr=caller_addr, caller_name=caller_name, syscall=entry.syscall)
+        stat = self.blocking[key]
+        ticks = packet.tick - entry.tick
+        stat.count += 1
+        stat.ticks += ticks
+        stat.max_ticks = max(stat.max_ticks, ticks)
+
+    def handle_module_packet(self, packet: PacketModule):
+        self.symbols.add_module(packet.name, packet.addr, packet.size_bytes, (packet.perm & MEMPERM_EXECUTE) != 0)
+
+    def handle_stats_packet(self, packet: PacketStats):
+        self.track_tick(packet.tick)
+        self.stats.append(packet)
+
+    def handle_dropped_packet(self, packet: PacketDropped):
+        self.track_tick(packet.tick)
+        self.dropped.append(packet)
+
+    @property
+    def dropped_samples(self) -> int:
+        return sum(d.samples for d in self.dropped)
+
+    @property
+    def stats_elapsed(self) -> int:
+        return sum(s.elapsed for s in self.stats)
+
+    def phase_stats(self, stats: list[PacketStats] | None = None) -> list[PhaseStat]:
+        """Combines the per interval phase statistics, of all intervals if stats is None."""
+        phases = [PhaseStat(name) for name in STATS_PHASE_NAMES]
+        for packet in self.stats if stats is None else stats:
+            for i, (count, min_ticks, max_ticks, ticks) in enumerate(packet.phases[:len(phases)]):
+                if count == 0:
+                    continue
+                phase = phases[i]
+                phase.min_ticks = min_ticks if phase.count == 0 else min(phase.min_ticks, min_ticks)
+                phase.max_ticks = max(phase.max_ticks, max_ticks)
+                phase.count += count
+                phase.ticks += ticks
+        return phases
+
+    def handle_service_packet(self, packet: PacketService):
+        self.services[packet.handle] = packet.name
+
+    def handle_ipc_request_packet(self, packet: PacketIpcRequest):
+        self.track_tick(packet.tick)
+        # Handles are reused, the name has to be taken at request time
+        service = self.services.get(packet.handle, f'0x{packet.handle:08X}')
+        self.ipc_requests[packet.thread_id] = (packet, service)
+
+    def caller_stack_str(self, return_addrs: list[int], max_depth: int = 4) -> str:
+        names = []
+        for addr in return_addrs:
+            name = self.symbols.get_nearest(addr)[1]
+            if name is None or (names and names[-1] == name):
+                continue
+            names.append(name)
+            if len(names) >= max_depth:
+                break
+        return ' <- '.join(names) if names else '?'
+
+    def handle_ipc_reply_packet(self, packet: PacketIpcReply):
+        self.track_tick(packet.tick)
+        pending = self.ipc_requests.pop(packet.thread_id, None)
+        if pending is None:
+            return
+        request, service = pending
+
+        command_id = request.command_header >> 16
+        key = (service, command_id)
+        if key not in self.ipc:
+            self.ipc[key] = IpcStat(service=service, command_id=command_id)
+        stat = self.ipc[key]
+
+        latency = packet.tick - request.tick
+        stat.latencies.append(latency)
+        caller = self.caller_stack_str([request.lr] + request.chain)
+        stat.callers.setdefault(caller, []).append(latency)
+
+    def ticks_to_ms(self, ticks: int) -> float:
+        return ticks * 1000 / self.tick_frequency
+
+    @property
+    def frame_times_ms(self) -> list[float]:
+        return [self.ticks_to_ms(end - start) for start, end in zip(self.frame_ticks, self.frame_ticks[1:])]
+
+    def is_break_selected(self) -> bool:
+        if self.core_filter is not None and self.break_core != self.core_filter:
+            return False
+        if self.min_frame_ms <= 0:
+            return True
+        if self.break_tick is None:
+            return False
+        # Samples before the first and after the last marker belong to no complete frame
+        i = bisect_right(self.frame_ticks, self.break_tick) - 1
+        if i < 0 or i + 1 >= len(self.frame_ticks):
+            return False
+        return self.ticks_to_ms(self.frame_ticks[i + 1] - self.frame_ticks[i]) >= self.min_frame_ms
+
+    def set_min_frame_ms(self, min_frame_ms: float):
+        self.min_frame_ms = min_frame_ms
+        self.rebuild()
+
+    def set_core_filter(self, core: int | None):
+        self.core_filter = core
+        self.rebuild()
+
+    def track_sample_tick(self, weight: float):
+        if self.break_tick is not None:
+            self.sample_ticks.append((self.break_tick, weight))
+
+    @property
+    def tick_frequency(self) -> int:
+        return self.session.tick_frequency if self.session else TICKS_PER_SECOND
+
+    def track_tick(self, tick: int):
+        if self.first_tick is None or tick < self.first_tick:
+            self.first_tick = tick
+        if self.last_tick is None or tick > self.last_tick:
+            self.last_tick = tick
+
+    def get_thread(self, thread_id: int) -> ThreadSchedule:
+        if thread_id not in self.threads:
+            self.threads[thread_id] = ThreadSchedule(thread_id=thread_id)
+        return self.threads[thread_id]
+
+    def handle_schedule_in_packet(self, packet: PacketScheduleIn):
+        self.track_tick(packet.tick)
+        thread = self.get_thread(packet.thread_id)
+        thread.running_since = packet.tick
+        thread.running_core = packet.core
+        thread.switches += 1
+
+    def handle_schedule_out_packet(self, packet: PacketScheduleOut):
+        self.track_tick(packet.tick)
+        thread = self.get_thread(packet.thread_id)
+        # Threads running when the capture started have no schedule in
+        start = thread.running_since if thread.running_since is not None else self.first_tick
+        thread.slices.append((start, packet.tick, packet.core))
+        thread.run_ticks += packet.tick - start
+        thread.running_since = None
+
+    @property
+    def schedule_ticks(self) -> int:
+        if self.first_tick is None or self.last_tick is None:
+            return 0
+        return self.last_tick - self.first_tick
+
+    def thread_slices(self, thread: ThreadSchedule) -> list[tuple[int, int, int]]:
+        # Threads still running when the capture ended run until the last event
+        if thread.running_since is None:
+            return thread.slices
+        return thread.slices + [(thread.running_since, self.last_tick, thread.running_core)]
+
+    def thread_run_ticks(self, thread: ThreadSchedule) -> int:
+        if thread.running_since is None:
+            return thread.run_ticks
+        return thread.run_ticks + self.last_tick - thread.running_since
+
+    def thread_utilization(self, thread: ThreadSchedule) -> float:
+        if self.schedule_ticks == 0:
+            return 0
+        return self.thread_run_ticks(thread) / self.schedule_ticks
+
+    @staticmethod
+    def get_event_name(event: int) -> str:
+        return EVENT_NAMES.get(event, f'Event 0x{event:02X}')
+
+    @property
+    def event_name(self) -> str:
+        return self.get_event_name(self.event)
+
+    @property
+    def miss_event(self) -> int | None:
+        """The recorded event that is neither cycles nor instructions, if any."""
+        for event in (self.counter_event, self.event):
+            if event not in (EVENT_CYCLES, EVENT_INSTRUCTIONS):
+                return event
+        return None
+
+    def handle_call_chain(self, pc: int, return_addrs: list[int], weight: float = 1, counters: dict[int, int] | None = None):
         chain = []
 
-        for addr in [packet.pc] + stack_return_addrs:
+        for addr in [pc] + return_addrs:
             nearest = self.symbols.get_nearest(addr)[0]
             if nearest is None:
                 continue
@@ -85,7 +503,13 @@ class Profile:
                 break
 
         for i, addr in enumerate(chain):
-            self.track_hit(addr, direct=(i == 0))
+            self.track_hit(addr, direct=(i == 0), weight=weight)
+
+        # Counters cover the whole interval, attributed to where it ended like the direct hit
+        if counters and chain:
+            func = self.funcs_by_addr[chain[0]]
+            for event, count in counters.items():
+                func.counters[event] = func.counters.get(event, 0) + count
 
         for i in range(len(chain) - 1):
             callee_addr = chain[i]
@@ -93,22 +517,108 @@ class Profile:
 
             caller_func = self.funcs_by_addr[caller_addr]
             if callee_addr in caller_func.callees:
-                caller_func.callees[callee_addr] += 1
+                caller_func.callees[callee_addr] += weight
             else:
-                caller_func.callees[callee_addr] = 1
+                caller_func.callees[callee_addr] = weight
 
     def handle_packet(self, packet):
         if isinstance(packet, PacketSample):
             self.handle_sample_packet(packet)
+        elif isinstance(packet, PacketSampleChain):
+            self.handle_sample_chain_packet(packet)
+        elif isinstance(packet, PacketAggregate):
+            self.handle_aggregate_packet(packet)
+        elif isinstance(packet, PacketInterval):
+            self.handle_interval_packet(packet)
+        elif isinstance(packet, PacketEvent):
+            self.handle_event_packet(packet)
+        elif isinstance(packet, PacketCounters):
+            self.handle_counters_packet(packet)
+        elif isinstance(packet, PacketSession):
+            self.handle_session_packet(packet)
+        elif isinstance(packet, PacketBreak):
+            self.handle_break_packet(packet)
+        elif isinstance(packet, PacketFrame):
+            self.handle_frame_packet(packet)
+        elif isinstance(packet, PacketSyscallIn):
+            self.handle_syscall_in_packet(packet)
+        elif isinstance(packet, PacketSyscallOut):
+            self.handle_syscall_out_packet(packet)
+        elif isinstance(packet, PacketModule):
+            self.handle_module_packet(packet)
+        elif isinstance(packet, PacketStats):
+            self.handle_stats_packet(packet)
+        elif isinstance(packet, PacketDropped):
+            self.handle_dropped_packet(packet)
+        elif isinstance(packet, PacketService):
+            self.handle_service_packet(packet)
+        elif isinstance(packet, PacketIpcRequest):
+            self.handle_ipc_request_packet(packet)
+        elif isinstance(packet, PacketIpcReply):
+            self.handle_ipc_reply_packet(packet)
+        elif isinstance(packet, PacketScheduleIn):
+            self.handle_schedule_in_packet(packet)
+        elif isinstance(packet, PacketScheduleOut):
+            self.handle_schedule_out_packet(packet)
 
     def load_from_file(self, path: str, offset: int = 0):
         with open(path, 'rb') as file:
             file.seek(offset)
             data = file.read()
+        # Returned position is in the file, so compressed captures report the decoded frames
+        consumed = None
+        resumed = self.compressed_tail_resume == (path, offset)
+        if resumed or is_compressed(data):
+            data, consumed = decompress_frames(data)
+            if resumed:
+                data = self.compressed_tail + data
         data_view = memoryview(data)
+        packets = []
         pos = 0
         while pos < len(data):
             packet = parse_packet(data_view[pos:])
+            if packet is None:
+                # Cut off tail, the returned position lets the next load continue at this packet
+                break
+            # Packet layouts change between versions, older captures can not be framed correctly
+            if isinstance(packet, PacketSession) and packet.version != FORMAT_VERSION:
+                raise ValueError(f'Unsupported capture format version {packet.version}, supported is {FORMAT_VERSION}')
             pos += packet.size
+            if isinstance(packet, PacketSampleDelta):
+                packet = self.stack_decoder.decode(packet)
+                if packet is None:
+                    continue
+            elif isinstance(packet, PacketChainDefine):
+                self.chain_defs[packet.chain_id] = packet.chain
+                continue
+            elif isinstance(packet, PacketSampleRef):
+                # Samples of one chain share its list, the chain is only parsed once
+                chain = self.chain_defs.get(packet.chain_id)
+                if chain is None:
+                    continue
+                packet = PacketSampleChain(thread_id=packet.thread_id, pc=packet.pc, lr=0, chain=chain)
+            elif isinstance(packet, PacketThreadSlot):
+                self.thread_slots[packet.slot] = packet.thread_id
+                continue
+            elif isinstance(packet, PacketSamplePc):
+                thread_id = self.thread_slots.get(packet.thread_slot)
+                if thread_id is None:
+                    continue
+                packet = PacketSampleChain(thread_id=thread_id, pc=packet.pc, lr=0, chain=[])
+            packets.append(packet)
+        self.packets += packets
+        self.rebuild()
+        if consumed is None:
+            return pos
+        self.compressed_tail = data[pos:]
+        self.compressed_tail_resume = (path, offset + consumed)
+        return consumed
+
+    def rebuild(self):
+        self.reset()
+
+        # Samples are selected by the frame they fall into, so all frames must be known first
+        self.frame_ticks = sorted(p.tick for p in self.packets if isinstance(p, PacketFrame))
+
+        for packet in self.packets:
             self.handle_packet(packet)
-        return pos
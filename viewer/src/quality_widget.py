@@ -0,0 +1,120 @@
+from PyQt6.QtWidgets import (QWidget, QVBoxLayout, QSplitter, QLabel, QTableWidget, QTableWidgetItem, QAbstractItemView)
+from PyQt6.QtCore import Qt
+from PyQt6.QtGui import QBrush, QColor
+
+from .profile import Profile, STATS_PHASE_FLUSH, STATS_PHASE_SAMPLE
+from .timeline_widget import NumberItem
+
+
+# Shares of the run time above which a capture is likely distorted by the profiler
+MAX_OVERHEAD_PERCENT = 10.0
+MAX_FLUSH_PERCENT = 2.0
+
+
+class QualityWidget(QWidget):
+    """Profiler self-overhead per phase and interval, to judge how much the capture is distorted."""
+
+    def __init__(self):
+        super().__init__()
+        self.setup_ui()
+
+    def setup_ui(self):
+        layout = QVBoxLayout(self)
+        layout.setContentsMargins(0, 0, 0, 0)
+
+        self.summary_label = QLabel(self)
+        self.summary_label.setWordWrap(True)
+        layout.addWidget(self.summary_label)
+
+        splitter = QSplitter(Qt.Orientation.Vertical, self)
+
+        self.phases_table = QTableWidget(splitter)
+        self.phases_table.setColumnCount(7)
+        self.phases_table.setHorizontalHeaderLabels(['Phase', 'Count', 'Min us', 'Avg us', 'Max us', 'Total ms', '% of Time'])
+        self.phases_table.setEditTriggers(QAbstractItemView.EditTrigger.NoEditTriggers)
+        self.phases_table.verticalHeader().setVisible(False)
+        splitter.addWidget(self.phases_table)
+
+        self.intervals_table = QTableWidget(splitter)
+        self.intervals_table.setColumnCount(5)
+        self.intervals_table.setHorizontalHeaderLabels(['Time s', 'Samples/s', 'Overhead %', 'Flush %', 'Max Flush us'])
+        self.intervals_table.setEditTriggers(QAbstractItemView.EditTrigger.NoEditTriggers)
+        self.intervals_table.setSortingEnabled(True)
+        self.intervals_table.verticalHeader().setVisible(False)
+        splitter.addWidget(self.intervals_table)
+
+        layout.addWidget(splitter)
+
+    def set_profile(self, profile: Profile):
+        self.phases_table.setRowCount(0)
+        self.intervals_table.setSortingEnabled(False)
+        self.intervals_table.setRowCount(0)
+
+        dropped = ''
+        if profile.dropped:
+            dropped = (f' {profile.dropped_samples} samples and {sum(d.packets for d in profile.dropped)} packets were dropped '
+                       f'in {len(profile.dropped)} gaps as the record buffer was full, '
+                       f'the profile under-represents the busiest moments.')
+
+        elapsed = profile.stats_elapsed
+        if elapsed == 0:
+            self.summary_label.setText('No profiler statistics recorded.' + dropped)
+            return
+
+        def ticks_to_us(ticks: float) -> float:
+            return profile.ticks_to_ms(ticks) * 1000
+
+        def percent(ticks: int, of: int) -> float:
+            return ticks * 100 / of if of else 0.0
+
+        phases = profile.phase_stats()
+        self.phases_table.setRowCount(len(phases))
+        for row, phase in enumerate(phases):
+            self.phases_table.setItem(row, 0, QTableWidgetItem(phase.name))
+            self.phases_table.setItem(row, 1, NumberItem(phase.count, f'{phase.count}'))
+            if phase.count == 0:
+                continue
+            avg_us = ticks_to_us(phase.ticks / phase.count)
+            self.phases_table.setItem(row, 2, NumberItem(ticks_to_us(phase.min_ticks), f'{ticks_to_us(phase.min_ticks):.0f}'))
+            self.phases_table.setItem(row, 3, NumberItem(avg_us, f'{avg_us:.0f}'))
+            self.phases_table.setItem(row, 4, NumberItem(ticks_to_us(phase.max_ticks), f'{ticks_to_us(phase.max_ticks):.0f}'))
+            total_ms = profile.ticks_to_ms(phase.ticks)
+            self.phases_table.setItem(row, 5, NumberItem(total_ms, f'{total_ms:.2f}'))
+            share = percent(phase.ticks, elapsed)
+            self.phases_table.setItem(row, 6, NumberItem(share, f'{share:.1f}'))
+
+        distorted = 0
+        highlight = QBrush(QColor('#e74c3c'))
+        self.intervals_table.setRowCount(len(profile.stats))
+        for row, packet in enumerate(profile.stats):
+            interval_phases = profile.phase_stats([packet])
+            overhead = percent(interval_phases[STATS_PHASE_SAMPLE].ticks, packet.elapsed)
+            flush = percent(interval_phases[STATS_PHASE_FLUSH].ticks, packet.elapsed)
+            samples_per_second = packet.samples * 1000 / profile.ticks_to_ms(packet.elapsed) if packet.elapsed else 0.0
+            time_s = profile.ticks_to_ms(packet.tick - (profile.first_tick or 0)) / 1000
+            max_flush_us = ticks_to_us(interval_phases[STATS_PHASE_FLUSH].max_ticks)
+
+            items = [
+                NumberItem(time_s, f'{time_s:.1f}'),
+                NumberItem(samples_per_second, f'{samples_per_second:.0f}'),
+                NumberItem(overhead, f'{overhead:.1f}'),
+                NumberItem(flush, f'{flush:.1f}'),
+                NumberItem(max_flush_us, f'{max_flush_us:.0f}'),
+            ]
+            if overhead > MAX_OVERHEAD_PERCENT or flush > MAX_FLUSH_PERCENT:
+                distorted += 1
+                for item in items:
+                    item.setForeground(highlight)
+            for column, item in enumerate(items):
+                self.intervals_table.setItem(row, column, item)
+        self.intervals_table.setSortingEnabled(True)
+
+        samples = sum(s.samples for s in profile.stats)
+        overhead = percent(phases[STATS_PHASE_SAMPLE].ticks, elapsed)
+        flush = percent(phases[STATS_PHASE_FLUSH].ticks, elapsed)
+        summary = (f'{samples * 1000 / profile.ticks_to_ms(elapsed):.0f} samples/s, profiler overhead {overhead:.1f}%, '
+                   f'flush stalls {flush:.1f}% of the run time.')
+        if distorted:
+            summary += (f' {distorted} of {len(profile.stats)} intervals exceed {MAX_OVERHEAD_PERCENT:.0f}% overhead '
+                        f'or {MAX_FLUSH_PERCENT:.0f}% flush stalls, samples there are likely distorted.')
+        self.summary_label.setText(summary + dropped)
@@ -11,6 +11,13 @@ class SymbolMap:
         self.sorted_addrs: list[int] = []
         self.code_data: list[tuple[str, int, bytes]] = []
 
+        # Executable ranges of the recorded module map, hard-coded ranges are used without one
+        self.executable_ranges: list[tuple[int, int]] = []
+
+        # Symbol files of dynamically loaded modules, loaded relative to the module once it is mapped
+        self.module_symbol_paths: dict[str, list[str]] = {}
+        self.loaded_modules: set[tuple[str, int]] = set()
+
     def __len__(self):
         return len(self.map)
 
@@ -18,13 +25,27 @@ class SymbolMap:
         self.map.clear()
         self.sorted_addrs.clear()
         self.code_data.clear()
+        self.executable_ranges.clear()
+        self.loaded_modules.clear()
         self.map_dirty = False
 
     def insert(self, addr: int, name: str):
         self.map[addr] = name
         self.map_dirty = True
 
-    def load_from_file(self, path: str):
+    def add_module_symbols(self, path: str, module_name: str):
+        self.module_symbol_paths.setdefault(module_name, []).append(path)
+
+    def add_module(self, name: str, addr: int, size: int, executable: bool):
+        if executable and (addr, addr + size) not in self.executable_ranges:
+            self.executable_ranges.append((addr, addr + size))
+
+        if name in self.module_symbol_paths and (name, addr) not in self.loaded_modules:
+            self.loaded_modules.add((name, addr))
+            for path in self.module_symbol_paths[name]:
+                self.load_from_file(path, base=addr)
+
+    def load_from_file(self, path: str, base: int = 0):
         # TODO: this is a big hack to support IDA and GCC maps
         IGNORE_PREFIXES = ['__mw_', '0', '(', 'loc_', 'locret_', 'def_', 'jpt_', 'off_', 'Abs ', 'dword_', 'word_', 'byte_', 'flt_']
 
@@ -49,7 +70,7 @@ class SymbolMap:
                     continue
                 name = name.replace('__', '::')
                 name = name.replace('(void)', '()')
-                self.insert(addr, name)
+                self.insert(base + addr, name)
 
     def get(self, addr: int) -> str | None:
         return self.map.get(addr)
@@ -124,6 +145,9 @@ class SymbolMap:
             return False
     
     def is_executable(self, addr: int) -> bool:
+        if self.executable_ranges:
+            return any(start <= addr < end for start, end in self.executable_ranges)
+
         # TODO: load this from symbol map
         if addr >= 0x00100000 and addr < 0x0056B000:
             return True
@@ -0,0 +1,98 @@
+from PyQt6.QtWidgets import (QWidget, QVBoxLayout, QSplitter, QGraphicsScene, QTableWidget, QTableWidgetItem,
+                             QAbstractItemView)
+from PyQt6.QtCore import Qt
+from PyQt6.QtGui import QBrush, QColor, QPen
+
+from .profile import Profile
+from .callgraph_widget import CallGraphView
+
+
+CORE_COLORS = ['#3498db', '#e67e22', '#2ecc71', '#9b59b6']
+
+ROW_HEIGHT = 20
+ROW_SPACING = 4
+LABEL_WIDTH = 100
+TIMELINE_WIDTH = 2000
+
+
+class NumberItem(QTableWidgetItem):
+    """Table item showing formatted text but sorting by its value."""
+
+    def __init__(self, value: float, text: str):
+        super().__init__(text)
+        self.value = value
+        self.setTextAlignment(Qt.AlignmentFlag.AlignRight | Qt.AlignmentFlag.AlignVCenter)
+
+    def __lt__(self, other):
+        if isinstance(other, NumberItem):
+            return self.value < other.value
+        return super().__lt__(other)
+
+
+class TimelineWidget(QWidget):
+    """Per-thread utilization table and context switch timeline from recorded schedule events."""
+
+    def __init__(self):
+        super().__init__()
+        self.setup_ui()
+
+    def setup_ui(self):
+        layout = QVBoxLayout(self)
+        layout.setContentsMargins(0, 0, 0, 0)
+
+        splitter = QSplitter(Qt.Orientation.Vertical, self)
+
+        self.table = QTableWidget(splitter)
+        self.table.setColumnCount(4)
+        self.table.setHorizontalHeaderLabels(['Thread', 'Run Time (ms)', 'Utilization %', 'Switches'])
+        self.table.setSelectionBehavior(QAbstractItemView.SelectionBehavior.SelectRows)
+        self.table.setEditTriggers(QAbstractItemView.EditTrigger.NoEditTriggers)
+        self.table.setSortingEnabled(True)
+        self.table.verticalHeader().setVisible(False)
+        splitter.addWidget(self.table)
+
+        self.scene = QGraphicsScene()
+        self.view = CallGraphView()
+        self.view.setScene(self.scene)
+        splitter.addWidget(self.view)
+
+        layout.addWidget(splitter)
+
+    def set_profile(self, profile: Profile):
+        threads = sorted(profile.threads.values(), key=lambda t: t.thread_id)
+
+        self.table.setSortingEnabled(False)
+        self.table.setRowCount(len(threads))
+        for row, thread in enumerate(threads):
+            self.table.setItem(row, 0, NumberItem(thread.thread_id, f'{thread.thread_id}'))
+
+            run_ms = profile.thread_run_ticks(thread) * 1000 / profile.tick_frequency
+            self.table.setItem(row, 1, NumberItem(run_ms, f'{run_ms:.1f}'))
+            utilization = profile.thread_utilization(thread) * 100
+            self.table.setItem(row, 2, NumberItem(utilization, f'{utilization:.1f}'))
+            self.table.setItem(row, 3, NumberItem(thread.switches, f'{thread.switches}'))
+        self.table.setSortingEnabled(True)
+
+        self.scene.clear()
+        if profile.schedule_ticks == 0:
+            return
+
+        scale = TIMELINE_WIDTH / profile.schedule_ticks
+        no_pen = QPen(Qt.PenStyle.NoPen)
+
+        for row, thread in enumerate(threads):
+            y = row * (ROW_HEIGHT + ROW_SPACING)
+
+            label = self.scene.addText(f'{thread.thread_id}')
+            label.setPos(-LABEL_WIDTH, y)
+
+            self.scene.addRect(0, y, TIMELINE_WIDTH, ROW_HEIGHT, no_pen, QBrush(QColor('#ecf0f1')))
+
+            for start, end, core in profile.thread_slices(thread):
+                x = (start - profile.first_tick) * scale
+                # Keep very short slices visible
+                width = max((end - start) * scale, 0.5)
+                color = QColor(CORE_COLORS[core % len(CORE_COLORS)])
+                self.scene.addRect(x, y, width, ROW_HEIGHT, no_pen, QBrush(color))
+
+        self.scene.setSceneRect(self.scene.itemsBoundingRect())
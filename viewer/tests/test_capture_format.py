@@ -0,0 +1,163 @@
+import os
+import random
+import struct
+import tempfile
+import unittest
+
+from src.profile import Profile, FORMAT_VERSION
+from src.packet import PacketSample
+from src.symbols import SymbolMap
+from src.compression import FRAME_HEADER_SIZE, FRAME_FLAG_STORED
+
+
+def header(kind: int) -> bytes:
+    return b'NP' + struct.pack('<H', kind)
+
+
+def session(version: int) -> bytes:
+    return header(9) + struct.pack('<IIQ8sQII', version, 268111856, 0, b'game', 0, 0x1000, 0x400)
+
+
+def sample(tick: int, pc: int) -> bytes:
+    return header(10) + struct.pack('<QI', tick, 0) + header(2) + struct.pack('<IIII', 1, pc, 0, 0)
+
+
+class StackDeltaEncoder:
+    """Mirrors recordDeltaSample of the sysmodule."""
+
+    def __init__(self, keyframe_interval: int):
+        self.keyframe_interval = keyframe_interval
+        self.snapshots: dict[int, tuple[int, list[int], int]] = {}  # thread_id -> (sp, stack, samples since keyframe)
+
+    def encode(self, thread_id: int, pc: int, sp: int, stack: list[int]) -> bytes:
+        snapshot_sp, snapshot, since_keyframe = self.snapshots.get(thread_id, (0, [], 0))
+        end = sp + len(stack) * 4
+        snapshot_end = snapshot_sp + len(snapshot) * 4
+        keyframe = not snapshot or since_keyframe >= self.keyframe_interval
+
+        suffix_count = 0
+        if not keyframe and (sp ^ snapshot_sp) & 3 == 0 and snapshot_sp < end <= snapshot_end:
+            snapshot_index = (end - snapshot_sp) // 4
+            while (suffix_count < len(stack) and suffix_count < snapshot_index and
+                   snapshot[snapshot_index - 1 - suffix_count] == stack[len(stack) - 1 - suffix_count]):
+                suffix_count += 1
+
+        self.snapshots[thread_id] = (sp, stack, 1 if keyframe else since_keyframe + 1)
+        changed = stack[:len(stack) - suffix_count]
+        return (header(20) + struct.pack('<IIIIII', thread_id, pc, 0, sp, len(stack) * 4, suffix_count) +
+                struct.pack(f'<{len(changed)}I', *changed))
+
+
+def stored_frames(data: bytes, block_size: int) -> bytes:
+    # Cut at a fixed size like the sysmodule does, regardless of packet boundaries
+    out = b''
+    for start in range(0, len(data), block_size):
+        block = data[start:start + block_size]
+        out += b'NZ' + struct.pack('<HII', FRAME_FLAG_STORED, len(block), len(block)) + block
+    return out
+
+
+class CaptureFormatTest(unittest.TestCase):
+    def load(self, data: bytes) -> tuple[Profile, int]:
+        with tempfile.NamedTemporaryFile(delete=False) as file:
+            file.write(data)
+        try:
+            profile = Profile(SymbolMap())
+            return profile, profile.load_from_file(file.name)
+        finally:
+            os.remove(file.name)
+
+    def test_rejects_v1_capture(self):
+        # Breaks were 12 bytes in version 1, reading them as 16 would misframe everything after
+        data = session(1) + header(10) + struct.pack('<Q', 1234) + header(2) + struct.pack('<IIII', 1, 0x100000, 0, 0)
+        with self.assertRaises(ValueError):
+            self.load(data)
+
+    def test_truncated_tail(self):
+        data = session(FORMAT_VERSION) + sample(5, 0x100010)
+        for cut in range(1, len(sample(6, 0x100010))):
+            profile, consumed = self.load(data + sample(6, 0x100010)[:cut])
+            self.assertLessEqual(consumed, len(data) + cut)
+            self.assertGreaterEqual(consumed, len(data))
+            self.assertGreaterEqual(len(profile.packets), 3)
+
+    def test_compressed_resume_across_cut_packet(self):
+        data = session(FORMAT_VERSION) + b''.join(sample(tick, 0x100000 + tick * 4) for tick in range(40))
+        block_size = 37
+        capture = stored_frames(data, block_size)
+        frame_size = FRAME_HEADER_SIZE + block_size
+        expected, _ = self.load(capture)
+
+        with tempfile.NamedTemporaryFile(delete=False) as file:
+            path = file.name
+        try:
+            # Every complete frame count of a capture still being written, with a partial frame after it
+            for frame_count in range(1, len(capture) // frame_size):
+                with open(path, 'wb') as file:
+                    file.write(capture[:frame_count * frame_size + 5])
+                profile = Profile(SymbolMap())
+                consumed = profile.load_from_file(path)
+                self.assertEqual(consumed, frame_count * frame_size)
+
+                with open(path, 'wb') as file:
+                    file.write(capture)
+                profile.load_from_file(path, consumed)
+                self.assertEqual(profile.packets, expected.packets)
+        finally:
+            os.remove(path)
+
+    def test_stack_delta_round_trip(self):
+        rng = random.Random(1)
+        encoder = StackDeltaEncoder(keyframe_interval=8)
+        top = 0x10002000
+        stacks = {thread_id: (top - 0x100, [rng.randrange(1 << 32) for _ in range(0x40)]) for thread_id in (1, 2, 3)}
+        data = session(FORMAT_VERSION)
+        full_size = len(data)
+        expected = []
+        for tick in range(500):
+            thread_id = rng.choice(list(stacks))
+            previous_sp, previous = stacks[thread_id]
+
+            # Calls and returns move sp, the deep part of the stack stays as it was
+            sp = max(top - 0x400, min(top - 0x40, previous_sp + rng.randrange(-8, 9) * 4))
+            old = dict(zip(range(previous_sp, top, 4), previous))
+            stack = [old.get(addr, rng.randrange(1 << 32)) for addr in range(sp, top, 4)]
+            # Locals of the innermost frames change between samples
+            for i in range(4):
+                if rng.random() < 0.5:
+                    stack[i] = rng.randrange(1 << 32)
+            stacks[thread_id] = (sp, stack)
+
+            data += header(10) + struct.pack('<QI', tick, 0)
+            data += encoder.encode(thread_id, 0x100000 + tick * 4, sp, stack)
+            full_size += 4 + 12 + 28 + len(stack) * 4
+            expected.append((thread_id, stack))
+
+        self.assertLess(len(data), full_size // 2)
+        profile, _ = self.load(data)
+        decoded = [(p.thread_id, p.stack) for p in profile.packets if isinstance(p, PacketSample)]
+        self.assertEqual(decoded, expected)
+
+    def test_counters_apply_to_running_thread(self):
+        symbols = SymbolMap()
+        symbols.insert(0x100000, 'running')
+        symbols.insert(0x200000, 'blocked')
+        profile = Profile(symbols)
+        data = session(FORMAT_VERSION) + header(10) + struct.pack('<QI', 5, 1)
+        data += header(6) + struct.pack('<IIII', 3000, 1000, 100, 2)
+        data += header(2) + struct.pack('<IIII', 1, 0x200010, 0, 0)
+        data += header(2) + struct.pack('<IIII', 2, 0x100010, 0, 0)
+        with tempfile.NamedTemporaryFile(delete=False) as file:
+            file.write(data)
+        try:
+            profile.load_from_file(file.name)
+        finally:
+            os.remove(file.name)
+
+        funcs = {func.name: func for func in profile.funcs}
+        self.assertTrue(funcs['running'].counters)
+        self.assertFalse(funcs['blocked'].counters)
+
+
+if __name__ == '__main__':
+    unittest.main()